@@ -44,9 +44,14 @@ using namespace std;
 #include "VersionInfo.h"
 #include "PluginManager.h"
 #include "ModuleFactory.h"
+#include "MiscUtils.h"
+#include "TimeHistogram.h"
+#include "DirtyPages.h"
+#include "TileTypes.h"
 #include "modules/Gui.h"
 #include "modules/World.h"
 #include "modules/Graphic.h"
+#include "modules/MapCache.h"
 using namespace DFHack;
 
 #include "SDL_events.h"
@@ -71,30 +76,87 @@ struct Core::Cond
 {
     Cond()
     {
-        predicate = false;
+        granted = false;
         wakeup = new tthread::condition_variable();
     }
     ~Cond()
     {
         delete wakeup;
     }
-    bool Lock(tthread::mutex * m)
+    tthread::condition_variable * wakeup;
+    bool granted;
+};
+
+struct Core::Holder
+{
+    tthread::thread::id id;
+    int depth;
+};
+
+struct Core::SuspendStats
+{
+    struct Entry
     {
-        while(!predicate)
-        {
-            wakeup->wait(*m);
-        }
-        predicate = false;
-        return true;
+        TimeHistogram wait;
+        TimeHistogram hold;
+    };
+    struct Hold
+    {
+        uint64_t start;
+        std::string command;
+    };
+    SuspendStats()
+    {
+        mut = new tthread::mutex();
+        frames = 0;
     }
-    bool Unlock()
+    ~SuspendStats()
     {
-        predicate = true;
-        wakeup->notify_one();
-        return true;
+        delete mut;
     }
-    tthread::condition_variable * wakeup;
-    bool predicate;
+    void reset()
+    {
+        tthread::lock_guard<tthread::mutex> lock(*mut);
+        per_command.clear();
+        total = Entry();
+        depth.reset();
+        frames = 0;
+    }
+    // called by a tool that just got the world
+    void acquired(uint64_t wait_start)
+    {
+        tthread::lock_guard<tthread::mutex> lock(*mut);
+        tthread::thread::id self = tthread::this_thread::get_id();
+        Hold & h = holds[self];
+        h.start = GetTimeUs64();
+        std::map<tthread::thread::id, std::string>::iterator it = commands.find(self);
+        h.command = (it != commands.end()) ? it->second : "(unknown)";
+        uint64_t wait = h.start - wait_start;
+        total.wait.add(wait);
+        per_command[h.command].wait.add(wait);
+    }
+    // called by a tool that is about to give the world back
+    void released()
+    {
+        tthread::lock_guard<tthread::mutex> lock(*mut);
+        std::map<tthread::thread::id, Hold>::iterator it = holds.find(tthread::this_thread::get_id());
+        if (it == holds.end())
+            return;
+        uint64_t hold = GetTimeUs64() - it->second.start;
+        total.hold.add(hold);
+        per_command[it->second.command].hold.add(hold);
+        holds.erase(it);
+    }
+    tthread::mutex * mut;
+    // the command each thread is currently running
+    std::map<tthread::thread::id, std::string> commands;
+    std::map<std::string, Entry> per_command;
+    Entry total;
+    // not a time: number of tools waiting when a frame started handing out the world
+    TimeHistogram depth;
+    uint64_t frames;
+    // the tool holding the world right now, by thread
+    std::map<tthread::thread::id, Hold> holds;
 };
 
 void cheap_tokenise(string const& input, vector<string> &output)
@@ -130,6 +192,37 @@ void cheap_tokenise(string const& input, vector<string> &output)
     }
 }
 
+// Cut a command line into the commands separated by ';'.
+// Semicolons inside quotes belong to the argument they are in.
+static void split_commands(string const& input, vector<string> &output)
+{
+    string cur;
+    bool quoted = false;
+
+    for (size_t i = 0; i < input.size(); i++) {
+        char c = input[i];
+        if (c == ';' && !quoted) {
+            output.push_back(cur);
+            cur.clear();
+            continue;
+        }
+        cur.push_back(c);
+        if (c == '"')
+            quoted = !quoted;
+        else if (c == '\\' && quoted && i+1 < input.size())
+            cur.push_back(input[++i]);
+    }
+    output.push_back(cur);
+}
+
+static bool is_blank(const string &command)
+{
+    for (size_t i = 0; i < command.size(); i++)
+        if (!isspace(command[i]))
+            return false;
+    return true;
+}
+
 struct IODATA
 {
     Core * core;
@@ -153,26 +246,36 @@ void fHKthread(void * iodata)
         std::string stuff = core->getHotkeyCmd(); // waits on mutex!
         if(!stuff.empty())
         {
-            vector <string> args;
-            cheap_tokenise(stuff, args);
-            if (args.empty()) {
-                core->con.printerr("Empty hotkey command.\n");
-                continue;
-            }
-            
-            string first = args[0];
-            args.erase(args.begin());
-            command_result cr = plug_mgr->InvokeCommand(first, args, false);
-
-            if(cr == CR_WOULD_BREAK)
+            vector <string> commands;
+            split_commands(stuff, commands);
+            // several commands bound to one key run under one suspension
+            CoreSuspender * suspend = 0;
+            if (commands.size() > 1)
+                suspend = new CoreSuspender(core);
+            for (size_t i = 0; i < commands.size(); i++)
             {
-                core->con.printerr("It isn't possible to run an interactive command outside the console.\n");
+                vector <string> args;
+                cheap_tokenise(commands[i], args);
+                if (args.empty()) {
+                    core->con.printerr("Empty hotkey command.\n");
+                    continue;
+                }
+
+                string first = args[0];
+                args.erase(args.begin());
+                command_result cr = plug_mgr->InvokeCommand(first, args, false);
+
+                if(cr == CR_WOULD_BREAK)
+                {
+                    core->con.printerr("It isn't possible to run an interactive command outside the console.\n");
+                }
             }
+            delete suspend;
         }
     }
 }
 
-static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clueless_counter, const string &command)
+static void runCommand(Core *core, PluginManager *plug_mgr, int &clueless_counter, const string &command, bool interactive)
 {
     Console & con = core->con;
     
@@ -211,12 +314,19 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                           "  fpause                - Force DF to pause.\n"
                           "  die                   - Force DF to close immediately\n"
                           "  keybinding            - Modify bindings of commands to keys\n"
+                          "  suspendstats          - Show how long commands wait for and hold the game\n"
                           "Plugin management (useful for developers):\n"
                           //"  belongs COMMAND       - Tell which plugin a command belongs to.\n"
                           "  plug [PLUGIN|v]       - List plugin state and description.\n"
+                          "  plug profile [PLUGIN] - Show plugin call counts and timings.\n"
+                          "  plug profile reset    - Forget the collected timings.\n"
+                          "  plug profile budget N - Warn about plugins taking over N us per frame (0 = off).\n"
                           "  load PLUGIN|all       - Load a plugin by name or load all possible plugins.\n"
                           "  unload PLUGIN|all     - Unload a plugin or all loaded plugins.\n"
                           "  reload PLUGIN|all     - Reload a plugin or all loaded plugins.\n"
+                          "\n"
+                          "Several commands can be chained with ';'. They all run without letting\n"
+                          "the game advance in between, and none of them may be interactive.\n"
                          );
             }
             else if (parts.size() == 1)
@@ -355,8 +465,10 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 "  fpause                - Force DF to pause.\n"
                 "  die                   - Force DF to close immediately\n"
                 "  keybinding            - Modify bindings of commands to keys\n"
+                "  suspendstats          - Show how long commands wait for and hold the game\n"
                 "  belongs COMMAND       - Tell which plugin a command belongs to.\n"
                 "  plug [PLUGIN|v]       - List plugin state and detailed description.\n"
+                "  plug profile          - Show plugin call counts and timings.\n"
                 "  load PLUGIN|all       - Load a plugin by name or load all possible plugins.\n"
                 "  unload PLUGIN|all     - Unload a plugin or all loaded plugins.\n"
                 "  reload PLUGIN|all     - Reload a plugin or all loaded plugins.\n"
@@ -379,6 +491,22 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                 }
             }
         }
+        else if(first == "plug" && parts.size() && parts[0] == "profile")
+        {
+            if(parts.size() == 2 && parts[1] == "reset")
+            {
+                plug_mgr->resetProfile();
+                con.print("Plugin timings cleared.\n");
+            }
+            else if(parts.size() == 3 && parts[1] == "budget")
+            {
+                plug_mgr->setFrameBudget(atoi(parts[2].c_str()));
+            }
+            else
+            {
+                plug_mgr->printProfile(con, parts.size() > 1 ? parts[1] : "");
+            }
+        }
         else if(first == "plug")
         {
             for(size_t i = 0; i < plug_mgr->size();i++)
@@ -432,6 +560,37 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
                     << "Later adds, and earlier items within one command have priority." << endl;
             }
         }
+        else if(first == "suspendstats")
+        {
+            if(parts.size() == 1 && parts[0] == "reset")
+            {
+                core->ResetSuspendStats();
+                con.print("Suspension statistics cleared.\n");
+            }
+            else if(parts.size() == 2 && parts[0] == "csv")
+            {
+                ofstream out(parts[1].c_str());
+                if(!out.good())
+                    con.printerr("Can't open %s for writing.\n", parts[1].c_str());
+                else
+                    core->PrintSuspendStats(out, true);
+            }
+            else if(parts.size() == 1 && parts[0] == "csv")
+            {
+                core->PrintSuspendStats(con, true);
+            }
+            else if(parts.empty())
+            {
+                core->PrintSuspendStats(con);
+            }
+            else
+            {
+                con << "Usage:" << endl
+                    << "  suspendstats            - show how long commands wait for and hold the game" << endl
+                    << "  suspendstats csv [FILE] - the same as CSV, optionally written to a file" << endl
+                    << "  suspendstats reset      - forget the collected data" << endl;
+            }
+        }
         else if(first == "fpause")
         {
             World * w = core->getWorld();
@@ -458,12 +617,16 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
             {
                 string first = parts[0];
                 parts.erase(parts.begin());
-                command_result res = plug_mgr->InvokeCommand(first, parts);
+                command_result res = plug_mgr->InvokeCommand(first, parts, interactive);
                 if(res == CR_NOT_IMPLEMENTED)
                 {
                     con.printerr("%s is not a recognized command.\n", first.c_str());
                     clueless_counter ++;
                 }
+                else if(res == CR_WOULD_BREAK)
+                {
+                    con.printerr("%s is interactive and can't be run as part of a batch.\n", first.c_str());
+                }
                 /*
                 else if(res == CR_FAILURE)
                 {
@@ -475,6 +638,35 @@ static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clue
     }
 }
 
+// Run several commands with the game suspended only once for all of them,
+// instead of letting it run a frame between each. Interactive commands
+// would stall the game while waiting for input, so they are refused.
+static void runBatch(Core *core, PluginManager *plug_mgr, int &clueless_counter, const vector<string> &commands)
+{
+    CoreSuspender suspend(core);
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        if (!is_blank(commands[i]))
+            runCommand(core, plug_mgr, clueless_counter, commands[i], false);
+    }
+}
+
+static void runInteractiveCommand(Core *core, PluginManager *plug_mgr, int &clueless_counter, const string &command)
+{
+    if (command.empty())
+        return;
+
+    // a comment runs to the end of the line, semicolons and all
+    size_t start = command.find_first_not_of(" \t");
+    vector <string> commands;
+    if (start == string::npos || command[start] != '#')
+        split_commands(command, commands);
+    if (commands.size() <= 1)
+        runCommand(core, plug_mgr, clueless_counter, command, true);
+    else
+        runBatch(core, plug_mgr, clueless_counter, commands);
+}
+
 static void loadInitFile(Core *core, PluginManager *plug_mgr, string fname)
 {
     ifstream init(fname);
@@ -483,11 +675,38 @@ static void loadInitFile(Core *core, PluginManager *plug_mgr, string fname)
 
     int tmp = 0;
     string command;
+    // lines between 'batch {' and '}' run with the game suspended once
+    bool in_batch = false;
+    vector <string> batch;
     while (getline(init, command))
     {
+        vector <string> parts;
+        cheap_tokenise(command, parts);
+        if (!in_batch && parts.size() == 2 && parts[0] == "batch" && parts[1] == "{")
+        {
+            in_batch = true;
+            continue;
+        }
+        if (in_batch)
+        {
+            if (parts.size() == 1 && parts[0] == "}")
+            {
+                runBatch(core, plug_mgr, tmp, batch);
+                batch.clear();
+                in_batch = false;
+            }
+            else if (!parts.empty() && parts[0][0] != '#')
+                split_commands(command, batch);
+            continue;
+        }
         if (!command.empty())
             runInteractiveCommand(core, plug_mgr, tmp, command);
     }
+    if (in_batch)
+    {
+        core->con.printerr("%s: missing '}' at the end of a batch.\n", fname.c_str());
+        runBatch(core, plug_mgr, tmp, batch);
+    }
 }
 
 // A thread function... for the interactive console.
@@ -557,8 +776,18 @@ Core::Core()
 
     // create mutex for syncing with interactive tasks
     AccessMutex = 0;
-    StackMutex = 0;
+    suspend_slots = 0;
+    holders = 0;
+    num_holders = 0;
+    queue_head = 0;
+    queue_size = 0;
+    active_holders = 0;
     core_cond = 0;
+    slot_cond = 0;
+    suspend_stats = 0;
+    map_cache = 0;
+    map_cache_used = false;
+    dirty_pages = 0;
     // set up hotkey capture
     hotkey_set = false;
     HotkeyMutex = 0;
@@ -627,6 +856,7 @@ bool Core::Init()
         return false;
     }
     cerr << "Version: " << vinfo->getVersion() << endl;
+    dirty_pages = new DirtyPages(p);
 
     cerr << "Initializing Console.\n";
     // init the console.
@@ -652,15 +882,26 @@ bool Core::Init()
     // initialize data defs
     virtual_identity::Init(this);
     df::global::InitGlobals();
+    // before anything can look tile types up from forEachBlock workers
+    initTileTables();
 
     // create mutex for syncing with interactive tasks
-    StackMutex = new mutex();
     AccessMutex = new mutex();
     misc_data_mutex=new mutex();
-    core_cond = new Core::Cond();
+    core_cond = new condition_variable();
+    slot_cond = new condition_variable();
+    suspend_slots = new Core::Cond[SUSPEND_SLOTS];
+    // all granted tools come from the queue, so there can't be more of them
+    holders = new Core::Holder[SUSPEND_SLOTS];
+    free_slots.reserve(SUSPEND_SLOTS);
+    for (size_t i = 0; i < SUSPEND_SLOTS; i++)
+        free_slots.push_back(&suspend_slots[i]);
+    suspend_stats = new Core::SuspendStats();
     cerr << "Initializing Plugins.\n";
     // create plugin manager
     plug_mgr = new PluginManager(this);
+    // plugins may use getPluginManager() from plugin_init, so load them only now
+    plug_mgr->init(this);
     cerr << "Starting IO thread.\n";
     // create IO thread
     IODATA *temp = new IODATA;
@@ -732,21 +973,60 @@ void *Core::GetData( std::string key )
 
 void Core::Suspend()
 {
-    Core::Cond * nc = new Core::Cond();
-    // put the condition on a stack
-    StackMutex->lock();
-        suspended_tools.push(nc);
-    StackMutex->unlock();
-    // wait until Core::Update() wakes up the tool
+    uint64_t wait_start = GetTimeUs64();
+    tthread::thread::id self = tthread::this_thread::get_id();
     AccessMutex->lock();
-        nc->Lock(AccessMutex);
+        // already holding the world, just nest
+        Core::Holder * held = findHolder();
+        if (held)
+        {
+            held->depth++;
+            AccessMutex->unlock();
+            return;
+        }
+        // only happens with more than SUSPEND_SLOTS tools waiting at once
+        while (free_slots.empty())
+            slot_cond->wait(*AccessMutex);
+        // queue up
+        Core::Cond * nc = free_slots.back();
+        free_slots.pop_back();
+        nc->granted = false;
+        suspend_queue[(queue_head + queue_size) % SUSPEND_SLOTS] = nc;
+        queue_size++;
+        // wait until Core::Update() grants us the world
+        while (!nc->granted)
+            nc->wakeup->wait(*AccessMutex);
+        Core::Holder & h = holders[num_holders++];
+        h.id = self;
+        h.depth = 1;
+        // the slot was only needed for the wakeup
+        free_slots.push_back(nc);
+        slot_cond->notify_one();
     AccessMutex->unlock();
+    suspend_stats->acquired(wait_start);
 }
 
 void Core::Resume()
 {
     AccessMutex->lock();
-        core_cond->Unlock();
+        Core::Holder * held = findHolder();
+        // unbalanced calls are ignored
+        if (held && --held->depth == 0)
+        {
+            // the game may change the map as soon as it runs again
+            if (map_cache)
+            {
+                map_cache->WriteAll();
+                delete map_cache;
+                map_cache = 0;
+                map_cache_used = false;
+            }
+            suspend_stats->released();
+            *held = holders[--num_holders];
+            // the last one out wakes up the simulation thread
+            if (--active_holders == 0)
+                core_cond->notify_one();
+        }
     AccessMutex->unlock();
 }
 
@@ -769,6 +1049,7 @@ int Core::Update()
     
     if (new_wdata != last_world_data_ptr) {
         last_world_data_ptr = new_wdata;
+        Simple::Maps::ClearFeatureCache();
         plug_mgr->OnStateChange(new_wdata ? SC_GAME_LOADED : SC_GAME_UNLOADED);
     }
 
@@ -785,29 +1066,159 @@ int Core::Update()
         }
     }
 
+    // what DF changed in this frame, before anyone else gets to change things
+    dirty_pages->Update();
+
     // notify all the plugins that a game tick is finished
     plug_mgr->OnUpdate();
 
     // wake waiting tools
-    // do not allow more tools to join in while we process stuff here
-    StackMutex->lock();
-    while (!suspended_tools.empty())
+    // only the tools already waiting get their turn in this frame,
+    // the ones that join in while we process stuff here wait for the next one
+    AccessMutex->lock();
+    size_t waiting = queue_size;
+    if (waiting)
     {
-        Core::Cond * nc = suspended_tools.top();
-        suspended_tools.pop();
-        AccessMutex->lock();
-            // wake tool
-            nc->Unlock();
-            // wait for tool to wake us
-            core_cond->Lock(AccessMutex);
-        AccessMutex->unlock();
-        // destroy condition
-        delete nc;
+        tthread::lock_guard<tthread::mutex> lock(*suspend_stats->mut);
+        suspend_stats->depth.add(waiting);
+        suspend_stats->frames++;
     }
-    StackMutex->unlock();
+    while (waiting)
+    {
+        // one tool at a time, nothing in DF or DFHack is safe to use from two at once.
+        // this serves no more requests per second than the old stack of
+        // allocated conditions did, it only stops allocating and serves in order
+        Core::Cond * nc = suspend_queue[queue_head];
+        queue_head = (queue_head + 1) % SUSPEND_SLOTS;
+        queue_size--;
+        waiting--;
+        active_holders++;
+        // wake tool
+        nc->granted = true;
+        nc->wakeup->notify_one();
+        // wait for the tool to wake us
+        while (active_holders)
+            core_cond->wait(*AccessMutex);
+    }
+    AccessMutex->unlock();
     return 0;
 };
 
+void Core::BeginCommand(const std::string & name)
+{
+    if (!suspend_stats)
+        return;
+    tthread::lock_guard<tthread::mutex> lock(*suspend_stats->mut);
+    suspend_stats->commands[tthread::this_thread::get_id()] = name;
+}
+
+void Core::EndCommand()
+{
+    if (!suspend_stats)
+        return;
+    {
+        tthread::lock_guard<tthread::mutex> lock(*suspend_stats->mut);
+        suspend_stats->commands.erase(tthread::this_thread::get_id());
+    }
+    // Still holding the world, so this command is part of a batch.
+    // Write its changes back so the next one can access the blocks directly,
+    // and forget all of them if it didn't use the cache, it might have
+    // changed the map behind its back.
+    tthread::lock_guard<tthread::mutex> lock(*AccessMutex);
+    Core::Holder * held = findHolder();
+    if (!held || !map_cache)
+        return;
+    map_cache->WriteAll();
+    if (!map_cache_used)
+        map_cache->trash();
+    // a memory limit is for the command that set it only
+    map_cache->setMemoryLimit(0);
+    map_cache_used = false;
+}
+
+Core::Holder * Core::findHolder()
+{
+    tthread::thread::id self = tthread::this_thread::get_id();
+    for (int i = 0; i < num_holders; i++)
+    {
+        if (holders[i].id == self)
+            return &holders[i];
+    }
+    return 0;
+}
+
+MapExtras::MapCache * Core::getMapCache()
+{
+    tthread::lock_guard<tthread::mutex> lock(*AccessMutex);
+    Core::Holder * held = findHolder();
+    if (!held)
+        return 0;
+    if (!map_cache)
+    {
+        if (!Simple::Maps::IsValid())
+            return 0;
+        map_cache = new MapExtras::MapCache;
+    }
+    map_cache_used = true;
+    return map_cache;
+}
+
+void Core::ResetSuspendStats()
+{
+    if (suspend_stats)
+        suspend_stats->reset();
+}
+
+static void printSuspendEntry(std::ostream & out, bool csv, const std::string & name,
+                              const char * what, const TimeHistogram & h)
+{
+    if (csv)
+    {
+        out << name << "," << what << "," << h.calls() << "," << h.sum() << ","
+            << h.percentile(50) << "," << h.percentile(99) << "," << h.max() << "\n";
+    }
+    else
+    {
+        out << stl_sprintf("%-20s %-5s %8llu %12.3f %10llu %10llu %10llu\n",
+                           name.c_str(), what, (unsigned long long)h.calls(), h.sum() / 1000.0,
+                           (unsigned long long)h.percentile(50),
+                           (unsigned long long)h.percentile(99),
+                           (unsigned long long)h.max());
+    }
+}
+
+void Core::PrintSuspendStats(std::ostream & out, bool csv)
+{
+    if (!suspend_stats)
+        return;
+    tthread::lock_guard<tthread::mutex> lock(*suspend_stats->mut);
+    if (csv)
+        out << "command,event,count,total_us,p50_us,p99_us,max_us\n";
+    else
+        out << stl_sprintf("%-20s %-5s %8s %12s %10s %10s %10s\n",
+                           "command", "event", "count", "total(ms)", "p50(us)", "p99(us)", "max(us)");
+
+    printSuspendEntry(out, csv, "(all)", "wait", suspend_stats->total.wait);
+    printSuspendEntry(out, csv, "(all)", "hold", suspend_stats->total.hold);
+    std::map<std::string, SuspendStats::Entry>::iterator it;
+    for (it = suspend_stats->per_command.begin(); it != suspend_stats->per_command.end(); ++it)
+    {
+        printSuspendEntry(out, csv, it->first, "wait", it->second.wait);
+        printSuspendEntry(out, csv, it->first, "hold", it->second.hold);
+    }
+
+    // queue depth isn't a time, but the columns mean the same
+    TimeHistogram & depth = suspend_stats->depth;
+    if (csv)
+        out << "(queue),depth," << depth.calls() << "," << depth.sum() << ","
+            << depth.percentile(50) << "," << depth.percentile(99) << "," << depth.max() << "\n";
+    else
+        out << "Queue depth: " << depth.calls() << " frames with waiting tools, median "
+            << depth.percentile(50) << ", p99 " << depth.percentile(99)
+            << ", max " << depth.max() << ".\n";
+    out << flush;
+}
+
 // FIXME: needs to terminate the IO threads and properly dismantle all the machinery involved.
 int Core::Shutdown ( void )
 {
@@ -819,6 +1230,8 @@ int Core::Shutdown ( void )
         delete plug_mgr;
         plug_mgr = 0;
     }
+    delete dirty_pages;
+    dirty_pages = 0;
     // invalidate all modules
     for(size_t i = 0 ; i < allModules.size(); i++)
     {
@@ -1000,7 +1413,10 @@ bool Core::AddKeyBinding(std::string keyspec, std::string cmdline)
     if (!parseKeySpec(keyspec, &sym, &binding.modifiers))
         return false;
 
-    cheap_tokenise(cmdline, binding.command);
+    // only the first of several ';'-separated commands decides when the key works
+    vector<string> commands;
+    split_commands(cmdline, commands);
+    cheap_tokenise(commands[0], binding.command);
     if (binding.command.empty())
         return false;
 
@@ -0,0 +1,302 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Internal.h"
+#include "Export.h"
+#include "DirtyPages.h"
+#include "MemAccess.h"
+
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+#include "DataDefs.h"
+#include "df/world.h"
+#include "df/map_block.h"
+#include "df/unit.h"
+#include "df/item_actual.h"
+
+using namespace DFHack;
+using df::global::world;
+
+// when the log gets longer, the oldest frames are forgotten
+static const size_t MAX_LOGGED = 1 << 20;
+// reading this many pages of pagemap costs less than another read call
+static const size_t RUN_GAP_PAGES = 64;
+
+namespace {
+    // spans don't overlap, so sorting them by start sorts them by end too
+    struct SpanStart
+    {
+        template<class A, class B>
+        bool operator() (const A & a, const B & b) const { return start(a) < start(b); }
+        static char * start(char * p) { return p; }
+        template<class S> static char * start(const S & s) { return s.start; }
+    };
+    template<class T>
+    bool sameObjects(const vector<void *> & seen, const vector<T *> & now)
+    {
+        return seen.size() == now.size() &&
+            (now.empty() || memcmp(&seen[0], &now[0], now.size() * sizeof(void *)) == 0);
+    }
+
+    template<class T>
+    void * const * firstObject(const vector<T *> & objects)
+    {
+        return objects.empty() ? 0 : (void * const *) &objects[0];
+    }
+
+    template<class T>
+    void castObjects(const vector<void *> & objects, vector<T *> & out)
+    {
+        out.clear();
+        out.reserve(objects.size());
+        for (size_t i = 0; i < objects.size(); i++)
+            out.push_back((T *) objects[i]);
+    }
+}
+
+DirtyPages::DirtyPages(Process * p)
+{
+    this->p = p;
+    users = 0;
+    frame = 0;
+    known_since = 0;
+    page_size = p->getPageSize();
+    index[BLOCKS].size = sizeof(df::map_block);
+    index[UNITS].size = sizeof(df::unit);
+    index[ITEMS].size = sizeof(df::item_actual);
+    for (int i = 0; i < NUM_KINDS; i++)
+        index[i].started = false;
+}
+
+DirtyPages::~DirtyPages()
+{
+}
+
+bool DirtyPages::enable()
+{
+    if (users)
+    {
+        users++;
+        return true;
+    }
+    if (!p->clearSoftDirty())
+        return false;
+    // some kernels take the clear without keeping the bits,
+    // so see if a write shows up before trusting it
+    static volatile char probe[2 * 65536];
+    char * page = (char *) (((size_t) probe + page_size - 1) / page_size * page_size);
+    vector<void *> written;
+    *(volatile char *) page = *(volatile char *) page + 1;
+    if (!p->getSoftDirty(page, page + 1, written) || written.empty())
+        return false;
+    p->clearSoftDirty();
+    users = 1;
+    known_since = frame;
+    return true;
+}
+
+void DirtyPages::disable()
+{
+    if (!users || --users)
+        return;
+    // nothing clears the bits any more, so DF doesn't pay for it either
+    log.clear();
+    runs.clear();
+    for (int i = 0; i < NUM_KINDS; i++)
+    {
+        index[i].seen.clear();
+        index[i].spans.clear();
+        index[i].started = false;
+    }
+}
+
+void DirtyPages::rebuild(int kind, void * const * objects, size_t count)
+{
+    Index & idx = index[kind];
+    vector<Span> spans;
+    spans.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!objects[i])
+            continue;
+        Span span = { (char *) objects[i], (char *) objects[i] + idx.size };
+        spans.push_back(span);
+    }
+    sort(spans.begin(), spans.end(), SpanStart());
+    if (idx.started)
+    {
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            if (!binary_search(idx.spans.begin(), idx.spans.end(), spans[i].start, SpanStart()))
+            {
+                Written w = { frame, uint32_t(kind), spans[i].start };
+                log.push_back(w);
+            }
+        }
+    }
+    idx.seen.assign(objects, objects + count);
+    idx.spans.swap(spans);
+    idx.started = true;
+}
+
+void DirtyPages::findRuns()
+{
+    vector<Span> all;
+    for (int i = 0; i < NUM_KINDS; i++)
+        all.insert(all.end(), index[i].spans.begin(), index[i].spans.end());
+    sort(all.begin(), all.end(), SpanStart());
+    runs.clear();
+    size_t gap = RUN_GAP_PAGES * page_size;
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        char * start = (char *) ((size_t) all[i].start / page_size * page_size);
+        char * end = all[i].end;
+        if (!runs.empty() && start <= runs.back().end + gap)
+        {
+            if (end > runs.back().end)
+                runs.back().end = end;
+        }
+        else
+        {
+            Span run = { start, end };
+            runs.push_back(run);
+        }
+    }
+}
+
+void DirtyPages::Update()
+{
+    if (!users)
+        return;
+    frame++;
+
+    // comparing the lists is a memcmp, cheap next to what DF does in a frame
+    bool moved = false;
+    if (world)
+    {
+        if (!sameObjects(index[BLOCKS].seen, world->map.map_blocks))
+        {
+            rebuild(BLOCKS, firstObject(world->map.map_blocks), world->map.map_blocks.size());
+            moved = true;
+        }
+        if (!sameObjects(index[UNITS].seen, world->units.all))
+        {
+            rebuild(UNITS, firstObject(world->units.all), world->units.all.size());
+            moved = true;
+        }
+        if (!sameObjects(index[ITEMS].seen, world->items.all))
+        {
+            rebuild(ITEMS, firstObject(world->items.all), world->items.all.size());
+            moved = true;
+        }
+    }
+    if (moved)
+        findRuns();
+
+    // the pages written since the last update, then start over
+    pages.clear();
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (!p->getSoftDirty(runs[i].start, runs[i].end, pages))
+        {
+            // lost track of this frame
+            known_since = frame;
+        }
+    }
+    if (!p->clearSoftDirty())
+        known_since = frame;
+
+    // the pages and the spans are both sorted, the objects on a page
+    // start before its end and end after its start
+    for (int k = 0; k < NUM_KINDS; k++)
+    {
+        vector<Span> & spans = index[k].spans;
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            char * page = (char *) pages[i];
+            char * page_end = page + page_size;
+            vector<Span>::iterator it = lower_bound(spans.begin(), spans.end(), page_end, SpanStart());
+            // back to the first one that could still reach into the page
+            while (it != spans.begin() && (it - 1)->end > page)
+                --it;
+            for (; it != spans.end() && it->start < page_end; ++it)
+            {
+                Written w = { frame, uint32_t(k), it->start };
+                log.push_back(w);
+            }
+        }
+    }
+
+    while (log.size() > MAX_LOGGED)
+    {
+        known_since = max(known_since, log.front().frame);
+        log.pop_front();
+    }
+}
+
+bool DirtyPages::getChanged(Kind kind, uint32_t since, vector<void *> & changed)
+{
+    changed.clear();
+    if (!users || since < known_since)
+        return false;
+    vector<Span> & spans = index[kind].spans;
+    for (deque<Written>::reverse_iterator it = log.rbegin(); it != log.rend() && it->frame > since; ++it)
+    {
+        if (it->kind != uint32_t(kind))
+            continue;
+        // gone since then
+        if (!binary_search(spans.begin(), spans.end(), (char *) it->object, SpanStart()))
+            continue;
+        changed.push_back(it->object);
+    }
+    sort(changed.begin(), changed.end());
+    changed.erase(unique(changed.begin(), changed.end()), changed.end());
+    return true;
+}
+
+bool DirtyPages::getChangedBlocks(uint32_t since, vector<df::map_block *> & changed)
+{
+    vector<void *> objects;
+    bool ok = getChanged(BLOCKS, since, objects);
+    castObjects(objects, changed);
+    return ok;
+}
+
+bool DirtyPages::getChangedUnits(uint32_t since, vector<df::unit *> & changed)
+{
+    vector<void *> objects;
+    bool ok = getChanged(UNITS, since, objects);
+    castObjects(objects, changed);
+    return ok;
+}
+
+bool DirtyPages::getChangedItems(uint32_t since, vector<df::item *> & changed)
+{
+    vector<void *> objects;
+    bool ok = getChanged(ITEMS, since, objects);
+    castObjects(objects, changed);
+    return ok;
+}
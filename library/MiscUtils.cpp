@@ -113,6 +113,13 @@ uint64_t GetTimeMs64()
     return ret;
 }
 
+uint64_t GetTimeUs64()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
 
 #else // Windows
 uint64_t GetTimeMs64()
@@ -134,4 +141,17 @@ uint64_t GetTimeMs64()
 
     return ret;
 }
+
+uint64_t GetTimeUs64()
+{
+    static LARGE_INTEGER freq;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // split to avoid overflowing the multiplication
+    uint64_t sec = now.QuadPart / freq.QuadPart;
+    uint64_t rem = now.QuadPart % freq.QuadPart;
+    return sec * 1000000 + rem * 1000000 / freq.QuadPart;
+}
 #endif
\ No newline at end of file
@@ -27,8 +27,10 @@ distribution.
 #include "MemAccess.h"
 #include "PluginManager.h"
 #include "Console.h"
+#include "MiscUtils.h"
 
 #include "DataDefs.h"
+#include "df/world.h"
 
 using namespace DFHack;
 
@@ -48,6 +50,9 @@ using namespace tthread;
 #endif
 
 #include <assert.h>
+#include <algorithm>
+
+using df::global::world;
 
 static int getdir (string dir, vector<string> &files)
 {
@@ -120,6 +125,67 @@ struct Plugin::RefLock
     mutex * mut;
     int refcount;
 };
+
+/*
+ * Timer wheel for plugin_onupdate scheduling. Plugins are hashed into slots
+ * by their deadline, so advancing the wheel by one step only looks at the
+ * plugins that could possibly be due in that step.
+ */
+struct PluginManager::UpdateWheel
+{
+    static const uint32_t SLOTS = 256;
+    std::vector <Plugin *> slots[SLOTS];
+    uint32_t now;
+    UpdateWheel()
+    {
+        now = 0;
+    }
+    static bool isDue(uint32_t deadline, uint32_t time)
+    {
+        return int32_t(deadline - time) <= 0;
+    }
+    void insert(Plugin * p)
+    {
+        slots[p->update_deadline % SLOTS].push_back(p);
+    }
+    void remove(Plugin * p)
+    {
+        std::vector <Plugin *> & slot = slots[p->update_deadline % SLOTS];
+        std::vector <Plugin *>::iterator it = std::find(slot.begin(), slot.end(), p);
+        if(it != slot.end())
+            slot.erase(it);
+    }
+    // move the wheel to 'time', appending the plugins that are due to 'due'.
+    void advance(uint32_t time, std::vector <Plugin *> & due)
+    {
+        size_t first = due.size();
+        // time went backwards (different save loaded), or jumped past a whole turn
+        uint32_t steps = int32_t(time - now) < 0 ? SLOTS : std::min(time - now, SLOTS);
+        bool rebase = int32_t(time - now) < 0;
+        for(uint32_t i = 1; i <= steps; i++)
+        {
+            std::vector <Plugin *> & slot = slots[(now + i) % SLOTS];
+            for(size_t j = 0; j < slot.size();)
+            {
+                if(rebase || isDue(slot[j]->update_deadline, time))
+                {
+                    due.push_back(slot[j]);
+                    slot[j] = slot.back();
+                    slot.pop_back();
+                }
+                else
+                    j++;
+            }
+        }
+        now = time;
+        // reschedule everything that fired
+        for(size_t i = first; i < due.size(); i++)
+        {
+            due[i]->update_deadline = time + due[i]->update_period;
+            insert(due[i]);
+        }
+    }
+};
 Plugin::Plugin(Core * core, const std::string & filepath, const std::string & _filename, PluginManager * pm)
 {
     filename = filepath;
@@ -140,6 +206,11 @@ Plugin::Plugin(Core * core, const std::string & filepath, const std::string & _f
     plugin_onupdate = 0;
     plugin_onstatechange = 0;
     state = PS_UNLOADED;
+    schedule = US_NEVER;
+    update_period = 1;
+    update_deadline = 0;
+    frame_time = 0;
+    last_budget_warning = 0;
     access = new RefLock();
 }
 
@@ -199,6 +270,8 @@ bool Plugin::load()
     plugin_onstatechange = (command_result (*)(Core *, state_change_event)) LookupPlugin(plug, "plugin_onstatechange");
     //name = _PlugName();
     plugin_lib = plug;
+    // default to the old behavior. plugin_init can override this.
+    parent->setUpdateSchedule(this, US_EVERY_FRAME, 1);
     if(plugin_init(&c,commands) == CR_OK)
     {
         state = PS_LOADED;
@@ -209,6 +282,7 @@ bool Plugin::load()
     else
     {
         con.printerr("Plugin %s has failed to initialize properly.\n", filename.c_str());
+        parent->setUpdateSchedule(this, US_NEVER, 1);
         ClosePlugin(plugin_lib);
         state = PS_BROKEN;
         access->unlock();
@@ -232,6 +306,7 @@ bool Plugin::unload()
         access->wait();
         // cleanup...
         parent->unregisterCommands(this);
+        parent->setUpdateSchedule(this, US_NEVER, 1);
         if(cr == CR_OK)
         {
             ClosePlugin(plugin_lib);
@@ -279,6 +354,7 @@ command_result Plugin::invoke( std::string & command, std::vector <std::string>
             PluginCommand &cmd = commands[i];
             if(cmd.name == command)
             {
+                c.BeginCommand(command);
                 // running interactive things from some other source than the console would break it
                 if(!interactive_ && cmd.interactive)
                     cr = CR_WOULD_BREAK;
@@ -298,13 +374,18 @@ command_result Plugin::invoke( std::string & command, std::vector <std::string>
                     }
                     else
                     {
+                        uint64_t start = GetTimeUs64();
                         cr = cmd.function(&c, parameters);
+                        parent->addProfileSample(this, PE_COMMAND, GetTimeUs64() - start);
                     }
                 }
                 else
                 {
+                    uint64_t start = GetTimeUs64();
                     cr = cmd.function(&c, parameters);
+                    parent->addProfileSample(this, PE_COMMAND, GetTimeUs64() - start);
                 }
+                c.EndCommand();
                 if (cr == CR_WRONG_USAGE && !cmd.usage.empty())
                     c.con << "Usage:\n" << cmd.usage << flush;
                 break;
@@ -348,7 +429,9 @@ command_result Plugin::on_update()
     access->lock_add();
     if(state == PS_LOADED && plugin_onupdate)
     {
+        uint64_t start = GetTimeUs64();
         cr = plugin_onupdate(&c);
+        parent->addProfileSample(this, PE_UPDATE, GetTimeUs64() - start);
     }
     access->lock_sub();
     return cr;
@@ -361,7 +444,9 @@ command_result Plugin::on_state_change(state_change_event event)
     access->lock_add();
     if(state == PS_LOADED && plugin_onstatechange)
     {
+        uint64_t start = GetTimeUs64();
         cr = plugin_onstatechange(&c, event);
+        parent->addProfileSample(this, PE_STATE_CHANGE, GetTimeUs64() - start);
     }
     access->lock_sub();
     return cr;
@@ -373,6 +458,19 @@ Plugin::plugin_state Plugin::getState() const
 }
 
 PluginManager::PluginManager(Core * core)
+{
+    cmdlist_mutex = new mutex();
+    schedule_mutex = new mutex();
+    frame_wheel = new UpdateWheel();
+    tick_wheel = new UpdateWheel();
+    frame_count = 0;
+    state_changed = false;
+    profile_mutex = new mutex();
+    frame_budget = 0;
+}
+
+// separate from the constructor, so plugin_init can already reach the manager through Core
+void PluginManager::init(Core * core)
 {
 #ifdef LINUX_BUILD
     string path = core->p->getPath() + "/hack/plugins/";
@@ -381,7 +479,6 @@ PluginManager::PluginManager(Core * core)
     string path = core->p->getPath() + "\\hack\\plugins\\";
     const string searchstr = ".plug.dll";
 #endif
-    cmdlist_mutex = new mutex();
     vector <string> filez;
     getdir(path, filez);
     for(size_t i = 0; i < filez.size();i++)
@@ -404,6 +501,10 @@ PluginManager::~PluginManager()
     }
     all_plugins.clear();
     delete cmdlist_mutex;
+    delete frame_wheel;
+    delete tick_wheel;
+    delete schedule_mutex;
+    delete profile_mutex;
 }
 
 Plugin *PluginManager::getPluginByName (const std::string & name)
@@ -441,20 +542,115 @@ bool PluginManager::CanInvokeHotkey(std::string &command, df::viewscreen *top)
 
 void PluginManager::OnUpdate( void )
 {
-    for(size_t i = 0; i < all_plugins.size(); i++)
+    // collect the due plugins first, so that they can reschedule themselves
+    // from plugin_onupdate without deadlocking
+    update_due.clear();
+    schedule_mutex->lock();
+    update_due.insert(update_due.end(), update_every_frame.begin(), update_every_frame.end());
+    frame_wheel->advance(++frame_count, update_due);
+    if(world)
+        tick_wheel->advance(world->frame_counter, update_due);
+    if(state_changed)
+    {
+        update_due.insert(update_due.end(), update_on_state_change.begin(), update_on_state_change.end());
+        state_changed = false;
+    }
+    schedule_mutex->unlock();
+
+    for(size_t i = 0; i < update_due.size(); i++)
     {
-        all_plugins[i]->on_update();
+        update_due[i]->on_update();
     }
+
+    if(frame_budget)
+        checkFrameBudget();
 }
 
 void PluginManager::OnStateChange( state_change_event event )
 {
+    schedule_mutex->lock();
+    state_changed = true;
+    schedule_mutex->unlock();
     for(size_t i = 0; i < all_plugins.size(); i++)
     {
         all_plugins[i]->on_state_change(event);
     }
 }
 
+bool PluginManager::setUpdateSchedule(const std::string & plugin, update_schedule mode, uint32_t period)
+{
+    Plugin * p = getPluginByName(plugin);
+    if(!p)
+        return false;
+    setUpdateSchedule(p, mode, period);
+    return true;
+}
+
+void PluginManager::setUpdateSchedule( Plugin * p, update_schedule mode, uint32_t period )
+{
+    if(!p->has_onupdate())
+        mode = US_NEVER;
+    if(period == 0)
+        period = 1;
+    tthread::lock_guard<tthread::mutex> lock(*schedule_mutex);
+    unscheduleUpdate(p);
+    p->schedule = mode;
+    p->update_period = period;
+    scheduleUpdate(p);
+}
+
+// must be called with schedule_mutex held
+void PluginManager::scheduleUpdate( Plugin * p )
+{
+    switch(p->schedule)
+    {
+    case US_EVERY_FRAME:
+        update_every_frame.push_back(p);
+        break;
+    case US_FRAMES:
+        p->update_deadline = frame_wheel->now + p->update_period;
+        frame_wheel->insert(p);
+        break;
+    case US_TICKS:
+        p->update_deadline = tick_wheel->now + p->update_period;
+        tick_wheel->insert(p);
+        break;
+    case US_STATE_CHANGE:
+        update_on_state_change.push_back(p);
+        break;
+    default:
+        break;
+    }
+}
+
+// must be called with schedule_mutex held
+void PluginManager::unscheduleUpdate( Plugin * p )
+{
+    vector <Plugin *>::iterator it;
+    switch(p->schedule)
+    {
+    case US_EVERY_FRAME:
+        it = std::find(update_every_frame.begin(), update_every_frame.end(), p);
+        if(it != update_every_frame.end())
+            update_every_frame.erase(it);
+        break;
+    case US_FRAMES:
+        frame_wheel->remove(p);
+        break;
+    case US_TICKS:
+        tick_wheel->remove(p);
+        break;
+    case US_STATE_CHANGE:
+        it = std::find(update_on_state_change.begin(), update_on_state_change.end(), p);
+        if(it != update_on_state_change.end())
+            update_on_state_change.erase(it);
+        break;
+    default:
+        break;
+    }
+    p->schedule = US_NEVER;
+}
+
 // FIXME: doesn't check name collisions!
 void PluginManager::registerCommands( Plugin * p )
 {
@@ -477,4 +673,83 @@ void PluginManager::unregisterCommands( Plugin * p )
         belongs.erase(cmds[i].name);
     }
     cmdlist_mutex->unlock();
-}
\ No newline at end of file
+}
+void PluginManager::addProfileSample( Plugin * p, profile_event event, uint64_t us )
+{
+    tthread::lock_guard<tthread::mutex> lock(*profile_mutex);
+    p->profile[event].add(us);
+    // commands run outside of the frame, they don't count against the budget
+    if(frame_budget && event != PE_COMMAND)
+        p->frame_time += us;
+}
+
+void PluginManager::checkFrameBudget( void )
+{
+    Core & c = Core::getInstance();
+    tthread::lock_guard<tthread::mutex> lock(*profile_mutex);
+    uint64_t now = 0;
+    for(size_t i = 0; i < all_plugins.size(); i++)
+    {
+        Plugin * p = all_plugins[i];
+        if(p->frame_time > frame_budget)
+        {
+            // don't flood the console with a warning every frame
+            if(!now)
+                now = GetTimeMs64();
+            if(now - p->last_budget_warning >= 1000)
+            {
+                c.con.printerr("Plugin %s took %llu us this frame (budget is %u us).\n",
+                               p->name.c_str(), (unsigned long long)p->frame_time, frame_budget);
+                p->last_budget_warning = now;
+            }
+        }
+        p->frame_time = 0;
+    }
+}
+
+void PluginManager::printProfile(Console & con, const std::string & plugin)
+{
+    static const char * event_names[PE_COUNT] = { "update", "statechange", "command" };
+    tthread::lock_guard<tthread::mutex> lock(*profile_mutex);
+    con.print("%-16s %-12s %10s %12s %10s %10s %10s\n",
+              "plugin", "event", "calls", "total(ms)", "p50(us)", "p99(us)", "max(us)");
+    for(size_t i = 0; i < all_plugins.size(); i++)
+    {
+        Plugin * p = all_plugins[i];
+        if(!plugin.empty() && plugin != p->name)
+            continue;
+        for(int j = 0; j < PE_COUNT; j++)
+        {
+            TimeHistogram & h = p->profile[j];
+            if(!h.calls())
+                continue;
+            con.print("%-16s %-12s %10llu %12.3f %10llu %10llu %10llu\n",
+                      p->name.c_str(), event_names[j],
+                      (unsigned long long)h.calls(), h.sum() / 1000.0,
+                      (unsigned long long)h.percentile(50),
+                      (unsigned long long)h.percentile(99),
+                      (unsigned long long)h.max());
+        }
+    }
+    if(frame_budget)
+        con.print("Frame budget: %u us per plugin.\n", frame_budget);
+}
+
+void PluginManager::resetProfile()
+{
+    tthread::lock_guard<tthread::mutex> lock(*profile_mutex);
+    for(size_t i = 0; i < all_plugins.size(); i++)
+    {
+        for(int j = 0; j < PE_COUNT; j++)
+            all_plugins[i]->profile[j].reset();
+        all_plugins[i]->frame_time = 0;
+    }
+}
+
+void PluginManager::setFrameBudget(uint32_t us)
+{
+    tthread::lock_guard<tthread::mutex> lock(*profile_mutex);
+    frame_budget = us;
+    for(size_t i = 0; i < all_plugins.size(); i++)
+        all_plugins[i]->frame_time = 0;
+}
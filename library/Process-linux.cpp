@@ -26,6 +26,8 @@ distribution.
 #include <dirent.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <string>
 #include <vector>
@@ -216,4 +218,55 @@ bool Process::setPermisions(const t_memrange & range,const t_memrange &trgrange)
     result=mprotect((void *)range.start, (size_t)range.end-(size_t)range.start,protect);
 
     return result==0;
-}
\ No newline at end of file
+}
+size_t Process::getPageSize()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+// see Documentation/vm/soft-dirty.txt in the kernel sources
+bool Process::clearSoftDirty()
+{
+    // 4 clears only the soft-dirty bits. Kernels without them reject it.
+    int fd = ::open("/proc/self/clear_refs", O_WRONLY);
+    if(fd < 0)
+        return false;
+    bool ok = ::write(fd, "4", 1) == 1;
+    ::close(fd);
+    return ok;
+}
+
+bool Process::getSoftDirty(void * start, void * end, vector<void *> & dirty)
+{
+    const uint64_t SOFT_DIRTY = 1ULL << 55;
+    const uint64_t PRESENT_OR_SWAPPED = 3ULL << 62;
+    size_t page_size = getPageSize();
+    size_t first = (size_t) start / page_size;
+    size_t last = ((size_t) end + page_size - 1) / page_size;
+
+    int fd = ::open("/proc/self/pagemap", O_RDONLY);
+    if(fd < 0)
+        return false;
+    // one 64-bit entry per page
+    uint64_t entries[512];
+    bool ok = true;
+    for(size_t page = first; page < last; )
+    {
+        size_t count = min(last - page, sizeof(entries) / sizeof(entries[0]));
+        ssize_t got = ::pread(fd, entries, count * 8, (off_t) page * 8);
+        if(got <= 0)
+        {
+            ok = false;
+            break;
+        }
+        count = got / 8;
+        for(size_t i = 0; i < count; i++)
+        {
+            if((entries[i] & SOFT_DIRTY) && (entries[i] & PRESENT_OR_SWAPPED))
+                dirty.push_back((void *) ((page + i) * page_size));
+        }
+        page += count;
+    }
+    ::close(fd);
+    return ok;
+}
@@ -369,3 +369,22 @@ bool Process::setPermisions(const t_memrange & range,const t_memrange &trgrange)
 	
 	return result;
 }
+
+size_t Process::getPageSize()
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+}
+
+// Windows only tracks writes to memory allocated with MEM_WRITE_WATCH,
+// which DF's heap isn't.
+bool Process::clearSoftDirty()
+{
+    return false;
+}
+
+bool Process::getSoftDirty(void * start, void * end, std::vector<void *> & dirty)
+{
+    return false;
+}
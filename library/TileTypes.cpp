@@ -26,8 +26,136 @@ distribution.
 #include "TileTypes.h"
 #include "Export.h"
 
+#include <vector>
+using std::vector;
+
 namespace DFHack
 {
+    namespace
+    {
+        // the tile types sorted out by what the lookups ask for
+        struct TileTables
+        {
+            int shapes, materials;
+            // the tile types of each shape and material, in enum order.
+            // row and column 0 hold the ones of any shape or material
+            vector< vector<df::tiletype> > kinds;
+            // the parsed direction strings
+            vector<TileDirection> directions;
+            // the tile types that only differ in their variant, one run per
+            // shape, material and special, and where each tile type's run starts
+            vector<df::tiletype> variants;
+            vector<uint16_t> group_start;
+            vector<uint16_t> group_size;
+
+            TileTables()
+            {
+                shapes = ENUM_LAST_ITEM(tiletype_shape) - ENUM_FIRST_ITEM(tiletype_shape) + 2;
+                materials = ENUM_LAST_ITEM(tiletype_material) - ENUM_FIRST_ITEM(tiletype_material) + 2;
+                kinds.resize(shapes * materials);
+                int count = ENUM_LAST_ITEM(tiletype) - ENUM_FIRST_ITEM(tiletype) + 1;
+                directions.resize(count);
+                group_start.resize(count);
+                group_size.resize(count, 0);
+                FOR_ENUM_ITEMS(tiletype, tt)
+                {
+                    int s = shapeIndex(tileShape(tt)), m = materialIndex(tileMaterial(tt));
+                    // the any-shape and any-material buckets, each only once
+                    kinds[s * materials + m].push_back(tt);
+                    if (m)
+                        kinds[s * materials].push_back(tt);
+                    if (s)
+                        kinds[m].push_back(tt);
+                    if (s && m)
+                        kinds[0].push_back(tt);
+                    directions[tt - ENUM_FIRST_ITEM(tiletype)] = tileDirection(tt);
+                }
+                FOR_ENUM_ITEMS(tiletype, tt)
+                {
+                    int i = tt - ENUM_FIRST_ITEM(tiletype);
+                    if (group_size[i])
+                        continue;
+                    // the first of a group collects the rest of it
+                    uint16_t start = variants.size();
+                    const vector<df::tiletype> & kind = of(tileShape(tt), tileMaterial(tt));
+                    for (size_t j = 0; j < kind.size(); j++)
+                    {
+                        if (tileSpecial(kind[j]) == tileSpecial(tt))
+                            variants.push_back(kind[j]);
+                    }
+                    uint16_t size = variants.size() - start;
+                    for (size_t j = start; j < variants.size(); j++)
+                    {
+                        int k = variants[j] - ENUM_FIRST_ITEM(tiletype);
+                        group_start[k] = start;
+                        group_size[k] = size;
+                    }
+                }
+            }
+
+            // 0 for NONE and for anything out of range
+            int shapeIndex(df::tiletype_shape shape) const
+            {
+                if (shape == tiletype_shape::NONE || !tiletype_shape::is_valid(shape))
+                    return 0;
+                return shape - ENUM_FIRST_ITEM(tiletype_shape) + 1;
+            }
+            int materialIndex(df::tiletype_material mat) const
+            {
+                if (mat == tiletype_material::NONE || !tiletype_material::is_valid(mat))
+                    return 0;
+                return mat - ENUM_FIRST_ITEM(tiletype_material) + 1;
+            }
+            const vector<df::tiletype> & of(df::tiletype_shape shape, df::tiletype_material mat) const
+            {
+                return kinds[shapeIndex(shape) * materials + materialIndex(mat)];
+            }
+        };
+
+        // made by initTileTables, not by a function-local static: those
+        // aren't thread-safe to initialize with every compiler we use
+        TileTables * tile_tables = 0;
+
+        const TileTables & tables()
+        {
+            if (!tile_tables)
+                initTileTables();
+            return *tile_tables;
+        }
+    }
+
+    void initTileTables()
+    {
+        if (!tile_tables)
+            tile_tables = new TileTables();
+    }
+
+    df::tiletype findTileType(const df::tiletype_shape tshape, const df::tiletype_material tmat, const df::tiletype_variant tvar, const df::tiletype_special tspecial, const TileDirection tdir)
+    {
+        const TileTables & t = tables();
+        // a shape or material that doesn't exist can't match anything
+        if (tshape != tiletype_shape::NONE && !t.shapeIndex(tshape))
+            return tiletype::Void;
+        if (tmat != tiletype_material::NONE && !t.materialIndex(tmat))
+            return tiletype::Void;
+        const vector<df::tiletype> & kind = t.of(tshape, tmat);
+        for (size_t i = 0; i < kind.size(); i++)
+        {
+            df::tiletype tt = kind[i];
+            // Don't require variant to match if the destination tile doesn't even have one
+            if (tvar != tiletype_variant::NONE && tvar != tileVariant(tt) && tileVariant(tt) != tiletype_variant::NONE)
+                continue;
+            // Same for special
+            if (tspecial != tiletype_special::NONE && tspecial != tileSpecial(tt) && tileSpecial(tt) != tiletype_special::NONE)
+                continue;
+            if (tdir && tdir != t.directions[tt - ENUM_FIRST_ITEM(tiletype)])
+                continue;
+            // Match!
+            return tt;
+        }
+        return tiletype::Void;
+    }
+
     df::tiletype findSimilarTileType (const df::tiletype sourceTileType, const df::tiletype_shape tshape)
     {
         df::tiletype match = tiletype::Void;
@@ -72,40 +200,41 @@ namespace DFHack
         }
 
         // Run through until perfect match found or hit end.
-        FOR_ENUM_ITEMS(tiletype, tt)
+        const TileTables & t = tables();
+        static const vector<df::tiletype> none;
+        const vector<df::tiletype> & kind = t.shapeIndex(tshape) ? t.of(tshape, tiletype_material::NONE) : none;
+        for (size_t i = 0; i < kind.size(); i++)
         {
+            df::tiletype tt = kind[i];
             if (value == (8|4|1))
                 break;
-            if (tileShape(tt) == tshape)
+            // Special flag match is mandatory, but only if it might possibly make a difference
+            if (tileSpecial(tt) != tiletype_special::NONE && cur_special != tiletype_special::NONE && tileSpecial(tt) != cur_special)
+                continue;
+
+            // Special case for constructions.
+            // Never turn a construction into a non-contruction.
+            if ((cur_material == tiletype_material::CONSTRUCTION) && (tileMaterial(tt) != cur_material))
+                continue;
+
+            value = 0;
+            //Material is high-value match
+            if (cur_material == tileMaterial(tt))
+                value |= 8;
+
+            // Direction is medium value match
+            if (cur_direction == t.directions[tt - ENUM_FIRST_ITEM(tiletype)])
+                value |= 4;
+
+            // Variant is low-value match
+            if (cur_variant == tileVariant(tt))
+                value |= 1;
+
+            // Check value against last match.
+            if (value > matchv)
             {
-                // Special flag match is mandatory, but only if it might possibly make a difference
-                if (tileSpecial(tt) != tiletype_special::NONE && cur_special != tiletype_special::NONE && tileSpecial(tt) != cur_special)
-                    continue;
-
-                // Special case for constructions.
-                // Never turn a construction into a non-contruction.
-                if ((cur_material == tiletype_material::CONSTRUCTION) && (tileMaterial(tt) != cur_material))
-                    continue;
-
-                value = 0;
-                //Material is high-value match
-                if (cur_material == tileMaterial(tt))
-                    value |= 8;
-
-                // Direction is medium value match
-                if (cur_direction == tileDirection(tt))
-                    value |= 4;
-
-                // Variant is low-value match
-                if (cur_variant == tileVariant(tt))
-                    value |= 1;
-
-                // Check value against last match.
-                if (value > matchv)
-                {
-                    match = tt;
-                    matchv = value;
-                }
+                match = tt;
+                matchv = value;
             }
         }
 
@@ -119,14 +248,8 @@ namespace DFHack
     {
         if (tileVariant(tile) == tiletype_variant::NONE)
             return tile;
-        std::vector<df::tiletype> matches;
-        FOR_ENUM_ITEMS(tiletype, tt)
-        {
-            if (tileShape(tt) == tileShape(tile) &&
-                tileMaterial(tt) == tileMaterial(tile) &&
-                tileSpecial(tt) == tileSpecial(tile))
-                matches.push_back(tt);
-        }
-        return matches[rand() % matches.size()];
+        const TileTables & t = tables();
+        int i = tile - ENUM_FIRST_ITEM(tiletype);
+        return t.variants[t.group_start[i] + rand() % t.group_size[i]];
     }
 }
@@ -0,0 +1,197 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+
+#pragma once
+#include "Pragma.h"
+#include "Export.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+namespace DFHack
+{
+    /**
+     * Hands out memory from big chunks, for scratch data that is thrown away
+     * all at once: the blocks of a MapCache, the work lists of a command.
+     * Thousands of small objects then don't each take a trip to the heap and
+     * don't fragment the address space. Single allocations can be given back
+     * with free(), they are handed out again to allocations of the same size.
+     * Nothing here runs constructors or destructors.
+     */
+    class Arena
+    {
+    public:
+        static const size_t ALIGN = 16;
+
+        explicit Arena(size_t chunk_size = 256 * 1024)
+        {
+            this->chunk_size = chunk_size;
+            chunks = 0;
+            cur = end = 0;
+            in_use = 0;
+            reserved_bytes = 0;
+        }
+        ~Arena()
+        {
+            release();
+        }
+        /// size bytes, aligned for any type
+        void * alloc(size_t size)
+        {
+            size = roundUp(size);
+            in_use += size;
+            FreeList * fl = freeList(size, false);
+            if (fl && fl->head)
+            {
+                void * p = fl->head;
+                fl->head = *(void **)p;
+                return p;
+            }
+            if (size_t(end - cur) < size)
+                newChunk(size);
+            void * p = cur;
+            cur += size;
+            return p;
+        }
+        /// give back an allocation of size bytes
+        void free(void * ptr, size_t size)
+        {
+            if (!ptr)
+                return;
+            size = roundUp(size);
+            in_use -= size;
+            FreeList * fl = freeList(size, true);
+            *(void **)ptr = fl->head;
+            fl->head = ptr;
+        }
+        /// forget all allocations at once, keeping the first chunk for reuse
+        void reset()
+        {
+            while (chunks && chunks->next)
+            {
+                Chunk * c = chunks->next;
+                chunks->next = c->next;
+                reserved_bytes -= c->size;
+                ::free(c);
+            }
+            if (chunks)
+            {
+                cur = firstByte(chunks);
+                end = (char *)chunks + chunks->size;
+            }
+            free_lists.clear();
+            in_use = 0;
+        }
+        /// forget all allocations and give the memory back to the system
+        void release()
+        {
+            reset();
+            if (chunks)
+                ::free(chunks);
+            chunks = 0;
+            cur = end = 0;
+            reserved_bytes = 0;
+        }
+        /// bytes handed out and not given back
+        size_t used() const
+        {
+            return in_use;
+        }
+        /// bytes taken from the system
+        size_t reserved() const
+        {
+            return reserved_bytes;
+        }
+    private:
+        Arena(const Arena &);
+        void operator=(const Arena &);
+
+        struct Chunk
+        {
+            Chunk * next;
+            size_t size;
+        };
+        struct FreeList
+        {
+            size_t size;
+            void * head;
+        };
+        static size_t roundUp(size_t size)
+        {
+            return (size + ALIGN - 1) & ~(ALIGN - 1);
+        }
+        // malloc only promises 8 bytes on some systems, so align the start by hand
+        static char * firstByte(Chunk * c)
+        {
+            uintptr_t p = (uintptr_t)((char *)c + sizeof(Chunk));
+            return (char *)((p + ALIGN - 1) & ~uintptr_t(ALIGN - 1));
+        }
+        // only a handful of sizes are used at once, so a list is fine
+        FreeList * freeList(size_t size, bool create)
+        {
+            for (size_t i = 0; i < free_lists.size(); i++)
+                if (free_lists[i].size == size)
+                    return &free_lists[i];
+            if (!create)
+                return 0;
+            FreeList fl = { size, 0 };
+            free_lists.push_back(fl);
+            return &free_lists.back();
+        }
+        // the first chunk stays first, so reset() can keep it
+        void newChunk(size_t min_size)
+        {
+            // room for the header and whatever the alignment skips
+            size_t header = sizeof(Chunk) + ALIGN - 1;
+            size_t size = header + min_size > chunk_size ? header + min_size : chunk_size;
+            Chunk * c = (Chunk *) malloc(size);
+            if (!c)
+                throw std::bad_alloc();
+            c->size = size;
+            if (chunks)
+            {
+                c->next = chunks->next;
+                chunks->next = c;
+            }
+            else
+            {
+                c->next = 0;
+                chunks = c;
+            }
+            reserved_bytes += size;
+            cur = firstByte(c);
+            end = (char *)c + size;
+        }
+
+        size_t chunk_size;
+        Chunk * chunks;
+        char * cur;
+        char * end;
+        size_t in_use;
+        size_t reserved_bytes;
+        std::vector<FreeList> free_lists;
+    };
+}
@@ -48,6 +48,11 @@ namespace df
     struct viewscreen;
 }
 
+namespace MapExtras
+{
+    class MapCache;
+}
+
 namespace DFHack
 {
     class Process;
@@ -59,6 +64,7 @@ namespace DFHack
     struct VersionInfo;
     class VersionInfoFactory;
     class PluginManager;
+    class DirtyPages;
     class Core;
     // anon type, pretty much
     struct DFLibrary;
@@ -77,6 +83,7 @@ namespace DFHack
         friend int  ::SDL_PollEvent(SDL::Event *);
         friend int  ::SDL_Init(uint32_t flags);
         friend int  ::wgetch(WINDOW * w);
+        friend class Plugin;
     public:
         /// Get the single Core instance or make one.
         static Core& getInstance()
@@ -85,7 +92,9 @@ namespace DFHack
             static Core instance;
             return instance;
         }
-        /// try to acquire the activity lock
+        /// try to acquire the activity lock.
+        /// A thread that already holds the lock gets it again right away.
+        /// Every Suspend needs a Resume.
         void Suspend(void);
         /// return activity lock
         void Resume(void);
@@ -102,6 +111,8 @@ namespace DFHack
         Notes * getNotes();
         /// get the graphic module
         Graphic * getGraphic();
+        /// get the plugin manager
+        PluginManager * getPluginManager() { return plug_mgr; }
         /// sets the current hotkey command
         bool setHotkeyCmd( std::string cmd );
         /// removes the hotkey command and gives it to the caller thread
@@ -116,6 +127,23 @@ namespace DFHack
         bool AddKeyBinding(std::string keyspec, std::string cmdline);
         std::vector<std::string> ListKeyBindings(std::string keyspec);
 
+        /// get the map cache shared by everything run during this suspension,
+        /// so chained commands don't read and decode the same blocks again.
+        /// Only for the thread holding the world, NULL otherwise or when
+        /// there is no map. Don't delete it. Changes are written back
+        /// when the command returns and at the latest when the world is
+        /// given back, so every command starts out with clean blocks.
+        MapExtras::MapCache * getMapCache();
+
+        /// get the tracker of what DF wrote to in each frame.
+        /// It does nothing until enabled, see DirtyPages.h
+        DirtyPages * getDirtyPages() { return dirty_pages; }
+
+        /// print suspension wait/hold statistics, as a table or as CSV
+        void PrintSuspendStats(std::ostream & out, bool csv = false);
+        /// forget the suspension statistics collected so far
+        void ResetSuspendStats();
+
         bool isWorldLoaded() { return (last_world_data_ptr != NULL); }
         df::viewscreen *getTopViewscreen() { return top_viewscreen; }
 
@@ -137,10 +165,39 @@ namespace DFHack
         bool errorstate;
         // regulate access to DF
         struct Cond;
+        static const size_t SUSPEND_SLOTS = 32;
         tthread::mutex * AccessMutex;
-        tthread::mutex * StackMutex;
-        std::stack < Core::Cond * > suspended_tools;
-        Core::Cond * core_cond;
+        // preallocated wakeup slots, so suspending doesn't allocate anything
+        Core::Cond * suspend_slots;
+        std::vector < Core::Cond * > free_slots;
+        // FIFO of waiting tools, a ring over SUSPEND_SLOTS entries
+        Core::Cond * suspend_queue[SUSPEND_SLOTS];
+        size_t queue_head;
+        size_t queue_size;
+        // tools currently holding the world, with their nesting depth
+        struct Holder;
+        Core::Holder * holders;
+        int num_holders;
+        // tools given the world by Update that haven't given it back yet
+        int active_holders;
+        // wakes Update when the last holder resumes
+        tthread::condition_variable * core_cond;
+        // wakes tools waiting for a free slot
+        tthread::condition_variable * slot_cond;
+        // suspension statistics
+        struct SuspendStats;
+        SuspendStats * suspend_stats;
+        // tell the statistics which command the calling thread is running
+        void BeginCommand(const std::string & name);
+        void EndCommand();
+        // the calling thread's entry in holders, or NULL. Needs AccessMutex.
+        Core::Holder * findHolder();
+        // shared map cache of the current holder
+        MapExtras::MapCache * map_cache;
+        // set when the running command asked for the map cache
+        bool map_cache_used;
+        // updated at the start of every frame
+        DirtyPages * dirty_pages;
         // FIXME: shouldn't be kept around like this
         DFHack::VersionInfoFactory * vif;
         // Module storage
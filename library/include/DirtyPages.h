@@ -0,0 +1,126 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#include "Pragma.h"
+#include "Export.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+
+namespace df
+{
+    struct map_block;
+    struct unit;
+    struct item;
+}
+
+namespace DFHack
+{
+    class Process;
+    /**
+     * Finds the map blocks, units and items DF wrote to, from the soft-dirty
+     * bits the kernel keeps for every page. Core updates it once per frame
+     * while something has it enabled. This only works on Linux kernels built
+     * with CONFIG_MEM_SOFT_DIRTY.
+     *
+     * A write anywhere on a page marks every object on it, so this can
+     * report objects that didn't change. It doesn't miss writes to the
+     * object itself, but data it points to (vectors, strings, other
+     * objects) isn't watched. Items are only watched as far as the common
+     * df::item_actual part goes. New objects count as written to.
+     *
+     * Tracking makes DF take a page fault on the first write to every page
+     * after each frame, so only enable it while it is needed.
+     */
+    class DFHACK_EXPORT DirtyPages
+    {
+    public:
+        enum Kind
+        {
+            BLOCKS,
+            UNITS,
+            ITEMS,
+            NUM_KINDS
+        };
+        DirtyPages(Process * p);
+        ~DirtyPages();
+        /// start tracking. Counted, every enable needs a disable.
+        /// false if the system can't track writes.
+        bool enable();
+        void disable();
+        bool isEnabled() { return users > 0; }
+        /// frames tracked so far, pass it to getChanged as 'since' next time
+        uint32_t getFrame() { return frame; }
+        /**
+         * The objects of one kind written to after frame 'since', sorted by
+         * address. Returns false when that is further back than what is
+         * kept, or from before tracking started. Look at all of them then.
+         * Only call while the game is suspended.
+         */
+        bool getChanged(Kind kind, uint32_t since, std::vector<void *> & changed);
+        bool getChangedBlocks(uint32_t since, std::vector<df::map_block *> & changed);
+        bool getChangedUnits(uint32_t since, std::vector<df::unit *> & changed);
+        bool getChangedItems(uint32_t since, std::vector<df::item *> & changed);
+        /// called by Core once per frame, before the plugins and tools get to run
+        void Update();
+    private:
+        struct Span
+        {
+            char * start;
+            char * end;
+        };
+        struct Written
+        {
+            uint32_t frame;
+            uint32_t kind;
+            void * object;
+        };
+        // where the objects of one kind are, sorted
+        struct Index
+        {
+            // the game's list as of the last update
+            std::vector<void *> seen;
+            std::vector<Span> spans;
+            size_t size;
+            // there was a list before, so objects not in it are new
+            bool started;
+        };
+        void rebuild(int kind, void * const * objects, size_t count);
+        void findRuns();
+        Process * p;
+        int users;
+        uint32_t frame;
+        // getChanged can only answer for 'since' at or after this
+        uint32_t known_since;
+        Index index[NUM_KINDS];
+        // page-aligned stretches of memory that hold all the objects
+        std::vector<Span> runs;
+        // what was written to, oldest first
+        std::deque<Written> log;
+        std::vector<void *> pages;
+        size_t page_size;
+    };
+}
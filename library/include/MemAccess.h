@@ -283,6 +283,14 @@ namespace DFHack
 
             /// modify permisions of memory range
             bool setPermisions(const t_memrange & range,const t_memrange &trgrange);
+
+            /// size of a memory page in bytes
+            size_t getPageSize();
+            /// start a new round of write tracking: clear the soft-dirty bits
+            /// of all pages. false if the system can't do it (only Linux can)
+            bool clearSoftDirty();
+            /// add the pages in [start, end) written to since clearSoftDirty to 'dirty'
+            bool getSoftDirty(void * start, void * end, std::vector<void *> & dirty);
     private:
         VersionInfo * my_descriptor;
         PlatformSpecific *d;
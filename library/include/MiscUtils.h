@@ -276,5 +276,11 @@ inline T clip_range(T a, T1 minv, T2 maxv) {
  */
 DFHACK_EXPORT uint64_t GetTimeMs64();
 
+/**
+ * Returns a monotonic timestamp in microseconds, for measuring intervals.
+ * Unlike GetTimeMs64, it is not related to the wall clock and never jumps.
+ */
+DFHACK_EXPORT uint64_t GetTimeUs64();
+
 DFHACK_EXPORT std::string stl_sprintf(const char *fmt, ...);
 DFHACK_EXPORT std::string stl_vsprintf(const char *fmt, va_list args);
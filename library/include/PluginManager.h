@@ -26,9 +26,11 @@ distribution.
 
 #include "Export.h"
 #include "Hooks.h"
+#include "TimeHistogram.h"
 #include <map>
 #include <string>
 #include <vector>
+#include <stdint.h>
 struct DFLibrary;
 namespace tthread
 {
@@ -42,6 +44,7 @@ namespace df
 namespace DFHack
 {
     class Core;
+    class Console;
     class PluginManager;
     class virtual_identity;
 
@@ -59,6 +62,23 @@ namespace DFHack
         SC_GAME_UNLOADED,
         SC_VIEWSCREEN_CHANGED
     };
+    /// How often plugin_onupdate gets called. See PluginManager::setUpdateSchedule.
+    enum update_schedule
+    {
+        US_EVERY_FRAME, ///< every frame (default for plugins with plugin_onupdate)
+        US_FRAMES,      ///< every N frames
+        US_TICKS,       ///< every N in-game ticks (world->frame_counter), never while paused
+        US_STATE_CHANGE,///< once in the frame following a state change event
+        US_NEVER        ///< not at all
+    };
+    /// What a profiling sample measures
+    enum profile_event
+    {
+        PE_UPDATE,
+        PE_STATE_CHANGE,
+        PE_COMMAND,
+        PE_COUNT
+    };
     struct DFHACK_EXPORT PluginCommand
     {
         typedef command_result (*command_function)(Core *, std::vector <std::string> &);
@@ -113,6 +133,7 @@ namespace DFHack
         ~Plugin();
         command_result on_update();
         command_result on_state_change(state_change_event event);
+        bool has_onupdate() const { return plugin_onupdate != 0; }
     public:
         bool load();
         bool unload();
@@ -140,6 +161,14 @@ namespace DFHack
         DFLibrary * plugin_lib;
         PluginManager * parent;
         plugin_state state;
+        // update scheduling, guarded by PluginManager::schedule_mutex
+        update_schedule schedule;
+        uint32_t update_period;
+        uint32_t update_deadline;
+        // profiling, guarded by PluginManager::profile_mutex
+        TimeHistogram profile[PE_COUNT];
+        uint64_t frame_time;
+        uint64_t last_budget_warning;
         command_result (*plugin_init)(Core *, std::vector <PluginCommand> &);
         command_result (*plugin_status)(Core *, std::string &);
         command_result (*plugin_shutdown)(Core *);
@@ -151,18 +180,39 @@ namespace DFHack
     // PRIVATE METHODS
         friend class Core;
         friend class Plugin;
+        struct UpdateWheel;
         PluginManager(Core * core);
         ~PluginManager();
+        void init(Core * core);
         void OnUpdate( void );
         void OnStateChange( state_change_event event );
         void registerCommands( Plugin * p );
         void unregisterCommands( Plugin * p );
+        void setUpdateSchedule( Plugin * p, update_schedule mode, uint32_t period );
+        void scheduleUpdate( Plugin * p );
+        void unscheduleUpdate( Plugin * p );
+        void addProfileSample( Plugin * p, profile_event event, uint64_t us );
+        void checkFrameBudget( void );
     // PUBLIC METHODS
     public:
         Plugin *getPluginByName (const std::string & name);
         Plugin *getPluginByCommand (const std::string &command);
         command_result InvokeCommand( std::string & command, std::vector <std::string> & parameters, bool interactive = true );
         bool CanInvokeHotkey(std::string &command, df::viewscreen *top);
+        /**
+         * Declare how often the named plugin wants its plugin_onupdate called.
+         * Can be used from plugin_init, commands or state change handlers.
+         * Plugins that don't declare anything are called every frame.
+         * The period is ignored for US_EVERY_FRAME, US_STATE_CHANGE and US_NEVER.
+         */
+        bool setUpdateSchedule(const std::string & plugin, update_schedule mode, uint32_t period = 1);
+        /// print call counts and timings of all plugins, or just the named one
+        void printProfile(Console & con, const std::string & plugin = "");
+        /// forget all collected timings
+        void resetProfile();
+        /// warn when a plugin spends more than 'us' microseconds in one frame. 0 disables.
+        void setFrameBudget(uint32_t us);
+        uint32_t getFrameBudget() { return frame_budget; }
         Plugin* operator[] (std::size_t index)
         {
             if(index >= all_plugins.size())
@@ -179,6 +229,18 @@ namespace DFHack
         std::map <std::string, Plugin *> belongs;
         std::vector <Plugin *> all_plugins;
         std::string plugin_path;
+        // update scheduling
+        tthread::mutex * schedule_mutex;
+        std::vector <Plugin *> update_every_frame;
+        std::vector <Plugin *> update_on_state_change;
+        std::vector <Plugin *> update_due;
+        UpdateWheel * frame_wheel;
+        UpdateWheel * tick_wheel;
+        uint32_t frame_count;
+        bool state_changed;
+        // profiling
+        tthread::mutex * profile_mutex;
+        uint32_t frame_budget;
     };
 
     // Predefined hotkey guards
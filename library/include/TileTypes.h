@@ -230,35 +230,23 @@ namespace DFHack
         return ENUM_ATTR(tiletype_shape, basic_shape, tileShape(tiletype)) == tiletype_shape_basic::Stair;
     }
 
+    /**
+     * Sort out the tables findTileType, findSimilarTileType and
+     * findRandomVariant use. Core does it at startup, before any plugin can
+     * start threads. Until then the lookups do it themselves.
+     */
+    DFHACK_EXPORT void initTileTables();
+
     /**
      * zilpin: Find the first tile entry which matches the given search criteria.
      * All parameters are optional.
      * To omit, specify NONE for that type
      * For tile directions, pass NULL to omit.
+     * Only the tile types of the given shape and material are looked at,
+     * they are sorted out once, the first time any of these is called.
      * @return matching index in tileTypeTable, or 0 if none found.
      */
-    inline
-    df::tiletype findTileType(const df::tiletype_shape tshape, const df::tiletype_material tmat, const df::tiletype_variant tvar, const df::tiletype_special tspecial, const TileDirection tdir)
-    {
-        FOR_ENUM_ITEMS(tiletype, tt)
-        {
-            if (tshape != tiletype_shape::NONE && tshape != tileShape(tt))
-                continue;
-            if (tmat != tiletype_material::NONE && tmat != tileMaterial(tt))
-                continue;
-            // Don't require variant to match if the destination tile doesn't even have one
-            if (tvar != tiletype_variant::NONE && tvar != tileVariant(tt) && tileVariant(tt) != tiletype_variant::NONE)
-                continue;
-            // Same for special
-            if (tspecial != tiletype_special::NONE && tspecial != tileSpecial(tt) && tileSpecial(tt) != tiletype_special::NONE)
-                continue;
-            if (tdir && tdir != tileDirection(tt))
-                continue;
-            // Match!
-            return tt;
-        }
-        return tiletype::Void;
-    }
+    DFHACK_EXPORT df::tiletype findTileType(const df::tiletype_shape tshape, const df::tiletype_material tmat, const df::tiletype_variant tvar, const df::tiletype_special tspecial, const TileDirection tdir);
 
     /**
      * zilpin: Find a tile type similar to the one given, but with a different class.
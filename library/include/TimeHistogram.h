@@ -0,0 +1,115 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+
+#pragma once
+#include "Pragma.h"
+#include "Export.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace DFHack
+{
+    /**
+     * Histogram of durations in microseconds, for cheap profiling.
+     * Buckets are logarithmic with four linear sub-buckets per power of two,
+     * so percentiles are accurate to within 25%. Adding a sample is O(1) and
+     * never allocates.
+     */
+    class TimeHistogram
+    {
+    public:
+        static const int BUCKETS = 128;
+
+        TimeHistogram()
+        {
+            reset();
+        }
+        void reset()
+        {
+            memset(buckets, 0, sizeof(buckets));
+            count = 0;
+            total = 0;
+            maximum = 0;
+        }
+        void add(uint64_t us)
+        {
+            buckets[bucketOf(us)]++;
+            count++;
+            total += us;
+            if (us > maximum)
+                maximum = us;
+        }
+        uint64_t calls() const { return count; }
+        uint64_t sum() const { return total; }
+        uint64_t max() const { return maximum; }
+        uint64_t mean() const { return count ? total / count : 0; }
+        /// upper bound of the bucket containing the given percentile (0-100)
+        uint64_t percentile(double pct) const
+        {
+            if (!count)
+                return 0;
+            uint64_t want = uint64_t(count * pct / 100.0);
+            if (want >= count)
+                want = count - 1;
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++)
+            {
+                seen += buckets[i];
+                if (seen > want)
+                {
+                    uint64_t bound = upperBound(i);
+                    return bound < maximum ? bound : maximum;
+                }
+            }
+            return maximum;
+        }
+    private:
+        static int bucketOf(uint64_t us)
+        {
+            if (us < 4)
+                return int(us);
+            if (us > 0xFFFFFFFFULL)
+                us = 0xFFFFFFFFULL;
+            int msb = 0;
+            for (uint64_t v = us; v > 1; v >>= 1)
+                msb++;
+            int sub = int(us >> (msb - 2)) & 3;
+            return (msb - 1) * 4 + sub;
+        }
+        static uint64_t upperBound(int bucket)
+        {
+            if (bucket < 4)
+                return bucket;
+            int msb = bucket / 4 + 1;
+            uint64_t sub = bucket % 4;
+            uint64_t lower = (4 + sub) << (msb - 2);
+            return lower + (uint64_t(1) << (msb - 2)) - 1;
+        }
+        uint32_t buckets[BUCKETS];
+        uint64_t count;
+        uint64_t total;
+        uint64_t maximum;
+    };
+}
@@ -0,0 +1,236 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#ifndef MAPEXTRAS_BRUSHES_H
+#define MAPEXTRAS_BRUSHES_H
+
+#include "modules/Maps.h"
+#include "modules/MapCache.h"
+#include "TileTypes.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace MapExtras
+{
+/**
+ * The tiles of a brush in one map block.
+ * Bit x of rows[y] is set for tile x,y of the block.
+ */
+struct BlockMask
+{
+    DFHack::DFCoord block;
+    uint16_t rows[16];
+    bool has(int x, int y) const
+    {
+        return (rows[y] >> x) & 1;
+    }
+};
+
+/**
+ * Brushes go through the tiles they cover one map block at a time,
+ * so painting a big area doesn't need a list of all of its tiles.
+ */
+class Brush
+{
+public:
+    virtual ~Brush(){};
+    /// start going through the blocks the brush covers at start
+    virtual void begin(MapCache & mc, DFHack::DFCoord start) = 0;
+    /// the next block with tiles of the brush in it, false when done.
+    /// blocks that aren't on the map are skipped
+    virtual bool next(BlockMask & mask) = 0;
+};
+/**
+ * generic 3D rectangle brush. you can specify the dimensions of
+ * the rectangle and optionally which tile is its 'center'
+ */
+class RectangleBrush : public Brush
+{
+public:
+    RectangleBrush(int x, int y, int z = 1, int centerx = -1, int centery = -1, int centerz = -1)
+    {
+        if(centerx == -1)
+            cx_ = x/2;
+        else
+            cx_ = centerx;
+        if(centery == -1)
+            cy_ = y/2;
+        else
+            cy_ = centery;
+        if(centerz == -1)
+            cz_ = z/2;
+        else
+            cz_ = centerz;
+        x_ = x;
+        y_ = y;
+        z_ = z;
+        mc_ = 0;
+    };
+    void begin(MapCache & mc, DFHack::DFCoord start)
+    {
+        mc_ = &mc;
+        min_ = DFHack::DFCoord(start.x - cx_, start.y - cy_, start.z - cz_);
+        max_ = DFHack::DFCoord(min_.x + x_ - 1, min_.y + y_ - 1, min_.z + z_ - 1);
+        // blocks go x first, then y, then z
+        iter_ = DFHack::DFCoord(min_.x >> 4, min_.y >> 4, min_.z);
+    };
+    bool next(BlockMask & mask)
+    {
+        while (mc_ && iter_.z <= max_.z)
+        {
+            DFHack::DFCoord block = iter_;
+            iter_.x++;
+            if(iter_.x > max_.x >> 4)
+            {
+                iter_.x = min_.x >> 4;
+                iter_.y++;
+                if(iter_.y > max_.y >> 4)
+                {
+                    iter_.y = min_.y >> 4;
+                    iter_.z++;
+                }
+            }
+            Block * b = mc_->BlockAt(block);
+            if(!b || !b->valid)
+                continue;
+            // the part of the rectangle inside the block
+            int x0 = std::max(min_.x - block.x * 16, 0), x1 = std::min(max_.x - block.x * 16, 15);
+            int y0 = std::max(min_.y - block.y * 16, 0), y1 = std::min(max_.y - block.y * 16, 15);
+            uint16_t row = uint16_t(((1 << (x1 + 1)) - 1) & ~((1 << x0) - 1));
+            mask.block = block;
+            for(int y = 0; y < 16; y++)
+                mask.rows[y] = (y >= y0 && y <= y1) ? row : 0;
+            return true;
+        }
+        return false;
+    };
+    ~RectangleBrush(){};
+private:
+    int x_, y_, z_;
+    int cx_, cy_, cz_;
+    MapCache * mc_;
+    DFHack::DFCoord min_, max_, iter_;
+};
+
+/**
+ * Base for brushes that find their tiles one by one. The tiles are
+ * collected into block masks by begin(), and handed out by next().
+ */
+class TileBrush : public Brush
+{
+public:
+    TileBrush() : next_(0) {};
+    bool next(BlockMask & mask)
+    {
+        if(next_ >= masks_.size())
+            return false;
+        mask = masks_[next_++];
+        return true;
+    };
+protected:
+    void clear()
+    {
+        masks_.clear();
+        index_.clear();
+        next_ = 0;
+    };
+    void add(DFHack::DFCoord tile)
+    {
+        DFHack::DFCoord block = tile / 16;
+        std::map<DFHack::DFCoord, size_t>::iterator it = index_.find(block);
+        if(it == index_.end())
+        {
+            BlockMask m;
+            m.block = block;
+            memset(m.rows, 0, sizeof(m.rows));
+            it = index_.insert(std::make_pair(block, masks_.size())).first;
+            masks_.push_back(m);
+        }
+        masks_[it->second].rows[tile.y % 16] |= 1 << (tile.x % 16);
+    };
+private:
+    std::vector<BlockMask> masks_;
+    std::map<DFHack::DFCoord, size_t> index_;
+    size_t next_;
+};
+
+/**
+ * stupid block brush, legacy. use when you want to apply something to a whole DF map block.
+ */
+class BlockBrush : public Brush
+{
+public:
+    BlockBrush(){};
+    ~BlockBrush(){};
+    void begin(MapCache & mc, DFHack::DFCoord start)
+    {
+        valid_ = mc.testCoord(start);
+        block_ = start / 16;
+    };
+    bool next(BlockMask & mask)
+    {
+        if(!valid_)
+            return false;
+        valid_ = false;
+        mask.block = block_;
+        memset(mask.rows, 0xFF, sizeof(mask.rows));
+        return true;
+    };
+private:
+    bool valid_;
+    DFHack::DFCoord block_;
+};
+
+/**
+ * Column from a position through open space tiles
+ * example: create a column of magma
+ */
+class ColumnBrush : public TileBrush
+{
+public:
+    ColumnBrush(){};
+    ~ColumnBrush(){};
+    void begin(MapCache & mc, DFHack::DFCoord start)
+    {
+        clear();
+        bool juststarted = true;
+        while (mc.testCoord(start))
+        {
+            df::tiletype tt = mc.tiletypeAt(start);
+            if(DFHack::LowPassable(tt) || juststarted && DFHack::HighPassable(tt))
+            {
+                add(start);
+                juststarted = false;
+                start.z++;
+            }
+            else break;
+        }
+    };
+};
+}
+#endif
@@ -0,0 +1,235 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2011 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+#ifndef MAPEXTRAS_FLOODFILL_H
+#define MAPEXTRAS_FLOODFILL_H
+
+#include "modules/Maps.h"
+#include <stdint.h>
+#include <vector>
+
+namespace MapExtras
+{
+/**
+ * Decides where a FloodFill goes. A tile is entered from a direction
+ * and can be entered again from another one until it has been visited.
+ */
+class FloodPolicy
+{
+public:
+    enum Direction
+    {
+        SIDE,   // from a tile on the same level, or the start
+        BELOW,  // from the tile below, going up
+        ABOVE   // from the tile above, going down
+    };
+    enum Action
+    {
+        STOP = 0,           // don't visit the tile now
+        VISIT = 1,          // visit the tile, but don't spread from it
+        SPREAD = 2 | VISIT, // visit the tile and its neighbours on the level
+        UP = 4,             // also go to the tile above
+        DOWN = 8            // also go to the tile below
+    };
+    virtual ~FloodPolicy() {}
+    /// what to do with an unvisited tile, a combination of Action bits
+    virtual int enter(DFHack::DFCoord pos, Direction from) = 0;
+    /// called once for each tile enter() said to visit
+    virtual void visit(DFHack::DFCoord pos, Direction from) = 0;
+};
+
+/**
+ * Scanline flood fill. Tiles are handled in runs along x, and only whole
+ * runs go on the work stack, so a big cave takes a few thousand pushes
+ * instead of several per tile. Visited tiles are kept in a bitset per
+ * map block, which stays set between fills until reset().
+ */
+class FloodFill
+{
+public:
+    /// diagonal: spread to all 8 neighbours on a level instead of 4
+    FloodFill(bool diagonal = false)
+    {
+        this->diagonal = diagonal;
+        DFHack::Simple::Maps::getSize(x_bmax, y_bmax, z_max);
+        reset();
+    }
+    /// forget all visited tiles
+    void reset()
+    {
+        block_rows.assign(x_bmax * y_bmax * z_max, 0);
+        // the block at 0 is never written, unvisited blocks point at it
+        rows.assign(16, 0);
+        seeds.clear();
+        spans = 0;
+    }
+    bool isVisited(DFHack::DFCoord pos)
+    {
+        if (!inside(pos.x, pos.y, pos.z))
+            return false;
+        return visited(pos.x, pos.y, pos.z);
+    }
+    /// runs the fill from start, returns the number of tiles visited
+    size_t fill(DFHack::DFCoord start, FloodPolicy & policy)
+    {
+        size_t count = 0;
+        push(start.x, start.x, start.y, start.z, FloodPolicy::SIDE);
+        while (!seeds.empty())
+        {
+            Span s = seeds.back();
+            seeds.pop_back();
+            spans++;
+            for (int x = s.x0; x <= s.x1; x++)
+            {
+                if (visited(x, s.y, s.z))
+                    continue;
+                int act = policy.enter(DFHack::DFCoord(x, s.y, s.z), s.from);
+                if ((act & FloodPolicy::SPREAD) == FloodPolicy::SPREAD)
+                    x = scan(x, s.y, s.z, s.from, act, policy, count);
+                else if (act & FloodPolicy::VISIT)
+                {
+                    Runs runs;
+                    mark(x, s.y, s.z, s.from, act, policy, runs, count);
+                    flush(runs, s.y, s.z);
+                }
+            }
+        }
+        return count;
+    }
+    /// number of runs taken off the work stack since the last reset()
+    size_t getSpans()
+    {
+        return spans;
+    }
+private:
+    struct Span
+    {
+        int16_t x0, x1, y, z;
+        FloodPolicy::Direction from;
+    };
+    // runs of tiles that go up and down, pushed when a run is done
+    struct Runs
+    {
+        int up0, up1, down0, down1;
+        Runs() : up0(-1), up1(-2), down0(-1), down1(-2) {}
+    };
+    bool inside(int x, int y, int z)
+    {
+        return x >= 0 && y >= 0 && z >= 0 && x < int(x_bmax * 16) &&
+               y < int(y_bmax * 16) && z < int(z_max);
+    }
+    uint32_t blockIndex(int x, int y, int z)
+    {
+        return (z * y_bmax + (y >> 4)) * x_bmax + (x >> 4);
+    }
+    bool visited(int x, int y, int z)
+    {
+        return (rows[block_rows[blockIndex(x, y, z)] + (y & 15)] >> (x & 15)) & 1;
+    }
+    void push(int x0, int x1, int y, int z, FloodPolicy::Direction from)
+    {
+        if (x0 < 0)
+            x0 = 0;
+        if (x1 >= int(x_bmax * 16))
+            x1 = x_bmax * 16 - 1;
+        if (x0 > x1 || !inside(x0, y, z))
+            return;
+        Span s = { int16_t(x0), int16_t(x1), int16_t(y), int16_t(z), from };
+        seeds.push_back(s);
+    }
+    void mark(int x, int y, int z, FloodPolicy::Direction from, int act,
+              FloodPolicy & policy, Runs & runs, size_t & count)
+    {
+        uint32_t & offset = block_rows[blockIndex(x, y, z)];
+        if (!offset)
+        {
+            offset = rows.size();
+            rows.resize(offset + 16, 0);
+        }
+        rows[offset + (y & 15)] |= 1 << (x & 15);
+        count++;
+        policy.visit(DFHack::DFCoord(x, y, z), from);
+        if (act & FloodPolicy::UP)
+            addRun(runs.up0, runs.up1, x, y, z + 1, FloodPolicy::BELOW);
+        if (act & FloodPolicy::DOWN)
+            addRun(runs.down0, runs.down1, x, y, z - 1, FloodPolicy::ABOVE);
+    }
+    // grows the run by x if it touches it, else pushes it and starts over
+    void addRun(int & x0, int & x1, int x, int y, int z, FloodPolicy::Direction from)
+    {
+        if (x == x0 - 1)
+            x0 = x;
+        else if (x == x1 + 1)
+            x1 = x;
+        else
+        {
+            push(x0, x1, y, z, from);
+            x0 = x1 = x;
+        }
+    }
+    void flush(Runs & runs, int y, int z)
+    {
+        push(runs.up0, runs.up1, y, z + 1, FloodPolicy::BELOW);
+        push(runs.down0, runs.down1, y, z - 1, FloodPolicy::ABOVE);
+    }
+    // visits the run through x, returns where it ends
+    int scan(int x, int y, int z, FloodPolicy::Direction from, int act,
+             FloodPolicy & policy, size_t & count)
+    {
+        Runs runs;
+        mark(x, y, z, from, act, policy, runs, count);
+        int left = x, right = x;
+        for (int dir = -1; dir <= 1; dir += 2)
+        {
+            int & end = dir < 0 ? left : right;
+            for (int nx = x + dir; nx >= 0 && nx < int(x_bmax * 16); nx += dir)
+            {
+                if (visited(nx, y, z))
+                    break;
+                int nact = policy.enter(DFHack::DFCoord(nx, y, z), FloodPolicy::SIDE);
+                if (nact & FloodPolicy::VISIT)
+                    mark(nx, y, z, FloodPolicy::SIDE, nact, policy, runs, count);
+                if ((nact & FloodPolicy::SPREAD) != FloodPolicy::SPREAD)
+                    break;
+                end = nx;
+            }
+        }
+        flush(runs, y, z);
+        int extra = diagonal ? 1 : 0;
+        push(left - extra, right + extra, y - 1, z, FloodPolicy::SIDE);
+        push(left - extra, right + extra, y + 1, z, FloodPolicy::SIDE);
+        return right;
+    }
+
+    bool diagonal;
+    uint32_t x_bmax, y_bmax, z_max;
+    // offset of each block's 16 rows of visited bits in rows, 0 if none
+    std::vector<uint32_t> block_rows;
+    std::vector<uint16_t> rows;
+    std::vector<Span> seeds;
+    size_t spans;
+};
+}
+#endif
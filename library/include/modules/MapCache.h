@@ -27,109 +27,192 @@ distribution.
 #define MAPEXTRAS_H
 
 #include "modules/Maps.h"
+#include "modules/Constructions.h"
 #include "TileTypes.h"
+#include "Arena.h"
 #include <stdint.h>
 #include <cstring>
+#include <map>
 #include "df/map_block.h"
 #include "df/block_square_event_mineralst.h"
 using namespace DFHack;
 using namespace DFHack::Simple;
 namespace MapExtras
 {
-void SquashVeins (DFCoord bcoord, mapblock40d & mb, t_blockmaterials & materials)
+/// The vein material of every mineral tile of a block, from the block's
+/// vein events in order. Where veins overlap, the last one wins.
+inline void SquashVeins (const std::vector <df::block_square_event_mineralst *> & veins,
+                         mapblock40d & mb, t_blockmaterials & materials)
 {
     memset(materials,-1,sizeof(materials));
-    std::vector <df::block_square_event_mineralst *> veins;
-    Maps::SortBlockEvents(bcoord.x,bcoord.y,bcoord.z,&veins);
-    //iterate through block rows
+    // bit k of row j: a mineral tile no vein has claimed yet
+    uint16_t open[16];
+    uint16_t any = 0;
     for(uint32_t j = 0;j<16;j++)
     {
-        //iterate through columns
+        open[j] = 0;
         for (uint32_t k = 0; k< 16;k++)
         {
-            df::tiletype tt = mb.tiletypes[k][j];
-            if(DFHack::tileMaterial(tt) == tiletype_material::MINERAL)
+            if(DFHack::tileMaterial(mb.tiletypes[k][j]) == tiletype_material::MINERAL)
+                open[j] |= 1 << k;
+        }
+        any |= open[j];
+    }
+    // the last vein wins, so going backwards every tile is written once
+    for(int i = (int) veins.size() - 1; i >= 0 && any; i--)
+    {
+        int16_t mat = veins[i]->inorganic_mat;
+        any = 0;
+        for(uint32_t j = 0;j<16;j++)
+        {
+            uint16_t covered = open[j] & veins[i]->tile_bitmask[j];
+            open[j] &= ~covered;
+            any |= open[j];
+            for(uint32_t k = 0; covered; k++, covered >>= 1)
             {
-                for(int i = (int) veins.size() - 1; i >= 0;i--)
-                {
-                    if(!!(((1 << k) & veins[i]->tile_bitmask[j]) >> k))
-                    {
-                        materials[k][j] = veins[i]->inorganic_mat;
-                        i = -1;
-                    }
-                }
+                if(covered & 1)
+                    materials[k][j] = mat;
             }
         }
     }
 }
 
-void SquashRocks ( std::vector< std::vector <uint16_t> > * layerassign, DFHack::mapblock40d & mb, DFHack::t_blockmaterials & materials)
+inline void SquashVeins (DFCoord bcoord, mapblock40d & mb, t_blockmaterials & materials)
+{
+    std::vector <df::block_square_event_mineralst *> veins;
+    Maps::SortBlockEvents(bcoord.x,bcoord.y,bcoord.z,&veins);
+    SquashVeins(veins, mb, materials);
+}
+
+/// The layer materials of all the geology regions in one array, 16 layers
+/// to a region and -1 past the last one. Region 0 is all -1 and stands in
+/// for biomes that point nowhere.
+struct GeologyTable
+{
+    std::vector<int16_t> mats;
+
+    void assign(const std::vector< std::vector <uint16_t> > & layerassign)
+    {
+        mats.assign((layerassign.size() + 1) * 16, -1);
+        for(size_t i = 0; i < layerassign.size(); i++)
+        {
+            for(size_t j = 0; j < layerassign[i].size() && j < 16; j++)
+                mats[(i + 1) * 16 + j] = layerassign[i][j];
+        }
+    }
+    /// 16 times -1
+    const int16_t * none() const
+    {
+        return &mats[0];
+    }
+    /// the 16 layers of a region
+    const int16_t * region(uint32_t index) const
+    {
+        if(index >= mats.size() / 16 - 1)
+            return none();
+        return &mats[(index + 1) * 16];
+    }
+};
+
+inline void SquashRocks ( const GeologyTable & geology, DFHack::mapblock40d & mb, DFHack::t_blockmaterials & materials)
 {
-    // get the layer materials
+    // the layers of every biome the designations can name
+    const int16_t * biomes[16];
+    for(uint32_t i = 0; i < 16; i++)
+    {
+        if(i < sizeof(mb.biome_indices))
+            biomes[i] = geology.region(mb.biome_indices[i]);
+        else
+            biomes[i] = geology.none();
+    }
     for(uint32_t xx = 0;xx<16;xx++)
     {
         for (uint32_t yy = 0; yy< 16;yy++)
         {
-            uint8_t test = mb.designation[xx][yy].bits.biome;
-            if( test >= sizeof(mb.biome_indices))
-            {
-                materials[xx][yy] = -1;
-                continue;
-            }
-            if (mb.biome_indices[test] >= layerassign->size())
-            {
-                materials[xx][yy] = -1;
-                continue;
-            }
-            materials[xx][yy] =
-            layerassign->at(mb.biome_indices[test])[mb.designation[xx][yy].bits.geolayer_index];
+            df::tile_designation des = mb.designation[xx][yy];
+            materials[xx][yy] = biomes[des.bits.biome][des.bits.geolayer_index];
         }
     }
 }
 
+/// What a tile is made of, named the way items and constructions do it:
+/// stone and ore are mat_type 0 with the inorganic as mat_index.
+/// Both are -1 where it isn't known.
+struct TileMaterial
+{
+    int16_t mat_type;
+    int32_t mat_index;
+};
+typedef TileMaterial t_tilematerials[16][16];
+
 class Block
 {
+    friend class MapCache;
     public:
-    Block(DFHack::DFCoord _bcoord, std::vector< std::vector <uint16_t> > * layerassign = 0)
+    /// Layers are allocated from arena if given, else from the heap.
+    Block(DFHack::DFCoord _bcoord, GeologyTable * geology = 0, DFHack::Arena * arena = 0)
     {
         dirty_designations = false;
         dirty_tiletypes = false;
         dirty_temperatures = false;
         dirty_blockflags = false;
         dirty_occupancies = false;
+        loaded_tiletypes = false;
+        loaded_designations = false;
+        loaded_occupancies = false;
         valid = false;
         bcoord = _bcoord;
-        if(Maps::ReadBlock40d(bcoord.x,bcoord.y,bcoord.z,&raw))
-        {
-            Maps::ReadTemperatures(bcoord.x,bcoord.y, bcoord.z,&temp1,&temp2);
-            SquashVeins(bcoord,raw,veinmats);
-            if(layerassign)
-                SquashRocks(layerassign,raw,basemats);
-            else
-                memset(basemats,-1,sizeof(basemats));
+        this->geology = geology;
+        veinmats = 0;
+        basemats = 0;
+        temps = 0;
+        lru_prev = lru_next = 0;
+        this->arena = arena;
+        // only the block header, the tile layers are read when first used
+        df::map_block * block = Maps::getBlock(bcoord.x,bcoord.y,bcoord.z);
+        if(block)
+        {
+            raw.position = bcoord;
+            memcpy(raw.biome_indices,block->region_offset, sizeof(block->region_offset));
+            raw.global_feature = block->global_feature;
+            raw.local_feature = block->local_feature;
+            raw.mystery = block->unk2;
+            raw.origin = block;
+            raw.blockflags.whole = block->flags.whole;
             valid = true;
         }
     }
+    ~Block()
+    {
+        freeLayer(veinmats);
+        freeLayer(basemats);
+        freeLayer(temps);
+    }
     int16_t veinMaterialAt(df::coord2d p)
     {
-        return veinmats[p.x][p.y];
+        loadVeinMaterials();
+        return veinmats->mat[p.x][p.y];
     }
     int16_t baseMaterialAt(df::coord2d p)
     {
-        return basemats[p.x][p.y];
+        loadBaseMaterials();
+        return basemats->mat[p.x][p.y];
     }
     void ClearMaterialAt(df::coord2d p)
     {
-        veinmats[p.x][p.y] = -1;
+        loadVeinMaterials();
+        veinmats->mat[p.x][p.y] = -1;
     }
 
     df::tiletype TileTypeAt(df::coord2d p)
     {
+        loadTiletypes();
         return raw.tiletypes[p.x][p.y];
     }
     bool setTiletypeAt(df::coord2d p, df::tiletype tiletype)
     {
         if(!valid) return false;
+        loadTiletypes();
         dirty_tiletypes = true;
         //printf("setting block %d/%d/%d , %d %d\n",x,y,z, p.x, p.y);
         raw.tiletypes[p.x][p.y] = tiletype;
@@ -138,35 +221,41 @@ class Block
 
     uint16_t temperature1At(df::coord2d p)
     {
-        return temp1[p.x][p.y];
+        loadTemperatures();
+        return temps->temp1[p.x][p.y];
     }
     bool setTemp1At(df::coord2d p, uint16_t temp)
     {
         if(!valid) return false;
+        loadTemperatures();
         dirty_temperatures = true;
-        temp1[p.x][p.y] = temp;
+        temps->temp1[p.x][p.y] = temp;
         return true;
     }
 
     uint16_t temperature2At(df::coord2d p)
     {
-        return temp2[p.x][p.y];
+        loadTemperatures();
+        return temps->temp2[p.x][p.y];
     }
     bool setTemp2At(df::coord2d p, uint16_t temp)
     {
         if(!valid) return false;
+        loadTemperatures();
         dirty_temperatures = true;
-        temp2[p.x][p.y] = temp;
+        temps->temp2[p.x][p.y] = temp;
         return true;
     }
 
     df::tile_designation DesignationAt(df::coord2d p)
     {
+        loadDesignations();
         return raw.designation[p.x][p.y];
     }
     bool setDesignationAt(df::coord2d p, df::tile_designation des)
     {
         if(!valid) return false;
+        loadDesignations();
         dirty_designations = true;
         //printf("setting block %d/%d/%d , %d %d\n",x,y,z, p.x, p.y);
         raw.designation[p.x][p.y] = des;
@@ -180,11 +269,13 @@ class Block
 
     df::tile_occupancy OccupancyAt(df::coord2d p)
     {
+        loadOccupancies();
         return raw.occupancy[p.x][p.y];
     }
     bool setOccupancyAt(df::coord2d p, df::tile_occupancy des)
     {
         if(!valid) return false;
+        loadOccupancies();
         dirty_occupancies = true;
         raw.occupancy[p.x][p.y] = des;
         return true;
@@ -219,7 +310,7 @@ class Block
         }
         if(dirty_temperatures)
         {
-            Maps::WriteTemperatures(bcoord.x,bcoord.y,bcoord.z, &temp1, &temp2);
+            Maps::WriteTemperatures(bcoord.x,bcoord.y,bcoord.z, &temps->temp1, &temps->temp2);
             dirty_temperatures = false;
         }
         if(dirty_blockflags)
@@ -240,56 +331,170 @@ class Block
     bool dirty_temperatures:1;
     bool dirty_blockflags:1;
     bool dirty_occupancies:1;
+    /// the header fields are always there, the tile arrays only once
+    /// they have been accessed through the methods above
     DFHack::mapblock40d raw;
     DFHack::DFCoord bcoord;
-    DFHack::t_blockmaterials veinmats;
-    DFHack::t_blockmaterials basemats;
-    DFHack::t_temperatures temp1;
-    DFHack::t_temperatures temp2;
+
+    private:
+    // every layer is copied from the game the first time it is needed
+    void loadTiletypes()
+    {
+        if(loaded_tiletypes || !valid) return;
+        memcpy(raw.tiletypes, raw.origin->tiletype, sizeof(DFHack::tiletypes40d));
+        loaded_tiletypes = true;
+    }
+    void loadDesignations()
+    {
+        if(loaded_designations || !valid) return;
+        memcpy(raw.designation, raw.origin->designation, sizeof(DFHack::designations40d));
+        loaded_designations = true;
+    }
+    void loadOccupancies()
+    {
+        if(loaded_occupancies || !valid) return;
+        memcpy(raw.occupancy, raw.origin->occupancy, sizeof(DFHack::occupancies40d));
+        loaded_occupancies = true;
+    }
+    void loadTemperatures()
+    {
+        if(temps || !valid) return;
+        temps = allocLayer<Temperatures>();
+        memcpy(temps->temp1, raw.origin->temperature_1, sizeof(DFHack::t_temperatures));
+        memcpy(temps->temp2, raw.origin->temperature_2, sizeof(DFHack::t_temperatures));
+    }
+    void loadVeinMaterials()
+    {
+        if(veinmats || !valid) return;
+        loadTiletypes();
+        veinmats = allocLayer<Materials>();
+        SquashVeins(bcoord,raw,veinmats->mat);
+    }
+    void loadBaseMaterials()
+    {
+        if(basemats || !valid) return;
+        basemats = allocLayer<Materials>();
+        if(geology)
+        {
+            loadDesignations();
+            SquashRocks(*geology,raw,basemats->mat);
+        }
+        else
+            memset(basemats->mat,-1,sizeof(DFHack::t_blockmaterials));
+    }
+    // the layers are plain data, no constructors needed
+    template<class T> T * allocLayer()
+    {
+        return arena ? (T *) arena->alloc(sizeof(T)) : new T;
+    }
+    template<class T> void freeLayer(T * layer)
+    {
+        if(arena)
+            arena->free(layer, sizeof(T));
+        else
+            delete layer;
+    }
+    bool loaded_tiletypes:1;
+    bool loaded_designations:1;
+    bool loaded_occupancies:1;
+    GeologyTable * geology;
+    // allocated separately, as most tools never look at them
+    struct Materials
+    {
+        DFHack::t_blockmaterials mat;
+    };
+    struct Temperatures
+    {
+        DFHack::t_temperatures temp1;
+        DFHack::t_temperatures temp2;
+    };
+    Materials * veinmats;
+    Materials * basemats;
+    Temperatures * temps;
+    DFHack::Arena * arena;
+    // MapCache keeps its blocks in a list, most recently used first
+    Block * lru_prev;
+    Block * lru_next;
 };
 
 class MapCache
 {
     public:
-    MapCache()
+    // big chunks, a block takes a few KB
+    MapCache() : arena(1024 * 1024)
     {
         valid = 0;
+        last_block = 0;
+        lru_head = lru_tail = 0;
+        memory_limit = 0;
+        constructions_read = false;
         Maps::getSize(x_bmax, y_bmax, z_max);
+        block_table.resize(z_max, 0);
         validgeo = Maps::ReadGeology( layerassign );
+        if(validgeo)
+            geology.assign(layerassign);
         valid = true;
     };
     ~MapCache()
     {
         trash();
+        for(size_t i = 0; i < block_table.size(); i++)
+            delete [] block_table[i];
     }
     bool isValid ()
     {
         return valid;
     }
+    /// Keep the cache under about this many bytes, 0 for no limit (the default).
+    /// When a new block doesn't fit, the ones unused for the longest time are
+    /// written back and dropped. This means that with a limit, a Block pointer
+    /// is only good until the next BlockAt.
+    void setMemoryLimit(size_t bytes)
+    {
+        memory_limit = bytes;
+    }
+    size_t memoryLimit()
+    {
+        return memory_limit;
+    }
+    /// bytes taken by the blocks in the cache
+    size_t memoryUsed()
+    {
+        return arena.used();
+    }
     /// get the map block at a *block* coord. Block coord = tile coord / 16
     Block * BlockAt (DFHack::DFCoord blockcoord)
     {
         if(!valid)
             return 0;
-        std::map <DFHack::DFCoord, Block*>::iterator iter = blocks.find(blockcoord);
-        if(iter != blocks.end())
+        // most access is spatially coherent, so this saves the table walk
+        if(last_block && blockcoord == last_coord)
+            return last_block;
+        // negative coords wrap around and fail this too
+        if(uint32_t(blockcoord.x) >= x_bmax || uint32_t(blockcoord.y) >= y_bmax || uint32_t(blockcoord.z) >= z_max)
+            return 0;
+        Block ** & level = block_table[blockcoord.z];
+        if(!level)
+        {
+            level = new Block * [x_bmax * y_bmax];
+            memset(level, 0, x_bmax * y_bmax * sizeof(Block *));
+        }
+        Block * & slot = level[blockcoord.y * x_bmax + blockcoord.x];
+        if(slot)
         {
-            return (*iter).second;
+            unlink(slot);
+            pushFront(slot);
         }
         else
         {
-            if(blockcoord.x < x_bmax && blockcoord.y < y_bmax && blockcoord.z < z_max)
-            {
-                Block * nblo;
-                if(validgeo)
-                    nblo = new Block(blockcoord, &layerassign);
-                else
-                    nblo = new Block(blockcoord);
-                blocks[blockcoord] = nblo;
-                return nblo;
-            }
-            return 0;
+            slot = new (arena.alloc(sizeof(Block))) Block(blockcoord, validgeo ? &geology : 0, &arena);
+            pushFront(slot);
+            if(memory_limit)
+                evict();
         }
+        last_coord = blockcoord;
+        last_block = slot;
+        return slot;
     }
     df::tiletype tiletypeAt (DFHack::DFCoord tilecoord)
     {
@@ -378,6 +583,41 @@ class MapCache
         }
         return 0;
     }
+    /**
+     * The material of every tile of the block at a *block* coord: layer stone
+     * and soil, veins, features and constructions. The features of the block
+     * are looked up once, the constructions of the map once for the cache.
+     * Returns false, with everything -1, if there is no such block.
+     */
+    bool materialsAt (DFHack::DFCoord blockcoord, t_tilematerials & mats)
+    {
+        Block * b = BlockAt(blockcoord);
+        bool valid_block = b && b->valid;
+        BlockFeatures features;
+        for(int x = 0; x < 16; x++)
+        {
+            for(int y = 0; y < 16; y++)
+            {
+                if(valid_block)
+                    mats[x][y] = resolveMaterial(b, df::coord2d(x,y), features);
+                else
+                    mats[x][y].mat_type = -1, mats[x][y].mat_index = -1;
+            }
+        }
+        return valid_block;
+    }
+    /// the material of one tile, see materialsAt
+    TileMaterial materialAt (DFHack::DFCoord tilecoord)
+    {
+        Block * b = BlockAt(tilecoord / 16);
+        if(b && b->valid)
+        {
+            BlockFeatures features;
+            return resolveMaterial(b, tilecoord % 16, features);
+        }
+        TileMaterial none = { -1, -1 };
+        return none;
+    }
     
     df::tile_designation designationAt (DFHack::DFCoord tilecoord)
     {
@@ -434,23 +674,66 @@ class MapCache
     }
     bool WriteAll()
     {
-        std::map<DFHack::DFCoord, Block *>::iterator p;
-        for(p = blocks.begin(); p != blocks.end(); p++)
+        for(Block * b = lru_head; b; b = b->lru_next)
         {
-            p->second->Write();
+            b->Write();
         }
         return true;
     }
     void trash()
     {
-        std::map<DFHack::DFCoord, Block *>::iterator p;
-        for(p = blocks.begin(); p != blocks.end(); p++)
+        // blocks and layers all come from the arena and
+        // have nothing to destroy, so drop them in one go
+        for(Block * b = lru_head; b; b = b->lru_next)
         {
-            delete p->second;
+            DFHack::DFCoord bc = b->bcoord;
+            block_table[bc.z][bc.y * x_bmax + bc.x] = 0;
         }
-        blocks.clear();
+        arena.reset();
+        lru_head = lru_tail = 0;
+        last_block = 0;
     }
     private:
+    void pushFront(Block * b)
+    {
+        b->lru_prev = 0;
+        b->lru_next = lru_head;
+        if(lru_head)
+            lru_head->lru_prev = b;
+        else
+            lru_tail = b;
+        lru_head = b;
+    }
+    void unlink(Block * b)
+    {
+        if(b->lru_prev)
+            b->lru_prev->lru_next = b->lru_next;
+        else
+            lru_head = b->lru_next;
+        if(b->lru_next)
+            b->lru_next->lru_prev = b->lru_prev;
+        else
+            lru_tail = b->lru_prev;
+    }
+    void drop(Block * b)
+    {
+        DFHack::DFCoord bc = b->bcoord;
+        block_table[bc.z][bc.y * x_bmax + bc.x] = 0;
+        b->~Block();
+        arena.free(b, sizeof(Block));
+    }
+    // write back and drop the oldest blocks until we fit the limit,
+    // but never the one that was just asked for
+    void evict()
+    {
+        while(arena.used() > memory_limit && lru_tail && lru_tail != lru_head)
+        {
+            Block * b = lru_tail;
+            unlink(b);
+            b->Write();
+            drop(b);
+        }
+    }
     volatile bool valid;
     volatile bool validgeo;
     uint32_t x_bmax;
@@ -459,7 +742,93 @@ class MapCache
     uint32_t y_tmax;
     uint32_t z_max;
     std::vector< std::vector <uint16_t> > layerassign;
-    std::map<DFHack::DFCoord, Block *> blocks;
+    GeologyTable geology;
+    // the features of one block, read when a tile needs them
+    struct BlockFeatures
+    {
+        bool read;
+        DFHack::t_feature local;
+        DFHack::t_feature global;
+        BlockFeatures() : read(false) {}
+    };
+    TileMaterial resolveMaterial(Block * b, df::coord2d p, BlockFeatures & features)
+    {
+        TileMaterial mat = { -1, -1 };
+        switch(tileMaterial(b->TileTypeAt(p)))
+        {
+        case tiletype_material::SOIL:
+        case tiletype_material::STONE:
+            mat.mat_type = 0;
+            mat.mat_index = b->baseMaterialAt(p);
+            break;
+        case tiletype_material::MINERAL:
+            mat.mat_type = 0;
+            mat.mat_index = b->veinMaterialAt(p);
+            break;
+        case tiletype_material::FEATURE:
+        {
+            if(!features.read)
+            {
+                Maps::ReadFeatures(&b->raw, &features.local, &features.global);
+                features.read = true;
+            }
+            df::tile_designation des = b->DesignationAt(p);
+            if(des.bits.feature_local && features.local.type != -1)
+            {
+                mat.mat_type = features.local.main_material;
+                mat.mat_index = features.local.sub_material;
+            }
+            else if(des.bits.feature_global && features.global.type != -1)
+            {
+                mat.mat_type = features.global.main_material;
+                mat.mat_index = features.global.sub_material;
+            }
+            break;
+        }
+        case tiletype_material::CONSTRUCTION:
+        {
+            readConstructions();
+            DFHack::DFCoord bc = b->bcoord;
+            DFHack::DFCoord pos(bc.x * 16 + p.x, bc.y * 16 + p.y, bc.z);
+            std::map<DFHack::DFCoord, TileMaterial>::const_iterator it = constructions.find(pos);
+            if(it != constructions.end())
+                mat = it->second;
+            break;
+        }
+        default:
+            break;
+        }
+        return mat;
+    }
+    // construction materials by position, read when first needed
+    void readConstructions()
+    {
+        if(constructions_read)
+            return;
+        constructions_read = true;
+        if(!Constructions::isValid())
+            return;
+        for(uint32_t i = 0; i < Constructions::getCount(); i++)
+        {
+            df::construction * construction = Constructions::getConstruction(i);
+            TileMaterial mat = { construction->mat_type, construction->mat_index };
+            constructions[construction->pos] = mat;
+        }
+    }
+    bool constructions_read;
+    std::map<DFHack::DFCoord, TileMaterial> constructions;
+    // blocks by position, a page of x_bmax * y_bmax pointers per z-level,
+    // allocated when something on that level is first looked at
+    std::vector< Block ** > block_table;
+    // all the blocks in the cache, most recently used first
+    Block * lru_head;
+    Block * lru_tail;
+    size_t memory_limit;
+    // all the memory of the blocks comes from here
+    DFHack::Arena arena;
+    // where the last lookup ended up
+    DFHack::DFCoord last_coord;
+    Block * last_block;
 };
 }
 #endif
\ No newline at end of file
@@ -258,6 +258,11 @@ extern DFHACK_EXPORT bool ReadFeatures(mapblock40d * block,t_feature * local, t_
  */
 extern DFHACK_EXPORT bool GetGlobalFeature(t_feature &feature, int32_t index);
 extern DFHACK_EXPORT bool GetLocalFeature(t_feature &feature, df::coord2d coord, int32_t index);
+/**
+ * The features above are read once for the whole map and looked up after that.
+ * Core clears them when a game is loaded or unloaded.
+ */
+extern DFHACK_EXPORT void ClearFeatureCache();
 
 /*
  * BLOCK DATA
@@ -274,6 +279,160 @@ extern DFHACK_EXPORT void getPosition(int32_t& x, int32_t& y, int32_t& z);
 extern DFHACK_EXPORT df::map_block * getBlock (int32_t blockx, int32_t blocky, int32_t blockz);
 extern DFHACK_EXPORT df::map_block * getBlockAbs (int32_t x, int32_t y, int32_t z);
 
+/**
+ * A pass over map blocks for forEachBlock.
+ *
+ * Every block is given to exactly one worker, so a pass may change the block
+ * it is given, but must not touch any other block or anything else that is
+ * shared. Workers must not print, throw, call into Core or use MapCache.
+ *
+ * Each worker gets its own copy of the visitor from fork(). When all blocks
+ * are done, every copy is merged back into the original with merge() and
+ * deleted. Counters and lists of results go into the visitor's members.
+ * Workers take blocks as they get to them, so which blocks end up in which
+ * copy changes from run to run. Sort lists after merging if order matters.
+ * \ingroup grp_maps
+ */
+class DFHACK_EXPORT BlockVisitor
+{
+public:
+    virtual ~BlockVisitor() {}
+    /// a fresh copy for one worker, with the results zeroed
+    virtual BlockVisitor * fork() = 0;
+    /// look at or change one block
+    virtual void visit(df::map_block * block) = 0;
+    /// add the results of a finished copy to this one
+    virtual void merge(BlockVisitor * part) {}
+};
+
+/**
+ * Visit all the blocks in world->map.map_blocks with several threads.
+ * threads = 0 uses one thread per core. Only call it while the game is
+ * suspended. Returns the number of blocks visited.
+ */
+extern DFHACK_EXPORT size_t forEachBlock(BlockVisitor & visitor, int threads = 0);
+
+/*
+ * CHANGE DETECTION
+ */
+
+/**
+ * Find the blocks that changed since the last call. Every block has a hash
+ * of its tile types, designations, occupancies and events. The blocks whose
+ * hash differs from the last call get a new generation number. A new map
+ * gives all the blocks a new generation. Events are compared by identity,
+ * type and vein bits, not by everything in them.
+ * While Core's DirtyPages tracking is enabled, only the blocks it saw
+ * written to are hashed again, along with the ones passed to
+ * markBlockWritten since the last call. DirtyPages only catches up at the
+ * start of a frame, so changes DFHack makes in the current suspension are
+ * only seen when they went through the Maps write functions, MapCache or
+ * markBlockWritten. Changes made only inside an event are missed then.
+ * Only call it while the game is suspended. Returns the current generation.
+ */
+extern DFHACK_EXPORT uint32_t updateGenerations();
+/**
+ * Tell updateGenerations that a block was changed in this frame. The Maps
+ * write functions and MapCache already do this, call it after writing to a
+ * df::map_block directly. Not from forEachBlock workers.
+ */
+extern DFHACK_EXPORT void markBlockWritten(df::map_block * block);
+/// the current generation, as returned by the last updateGenerations. 0 before the first one
+extern DFHACK_EXPORT uint32_t getGeneration();
+/// the generation of one block, 0 if it is not known
+extern DFHACK_EXPORT uint32_t getBlockGeneration(int32_t blockx, int32_t blocky, int32_t blockz);
+/**
+ * Updates the generations and puts the blocks changed after generation
+ * 'since' into 'changed'. since = 0 gives all the blocks. Keep the returned
+ * generation and pass it as 'since' on the next call.
+ */
+extern DFHACK_EXPORT uint32_t getChangedBlocks(uint32_t since, std::vector<df::map_block *> & changed);
+
+/**
+ * What is in a block, for whole-map queries that skip blocks without
+ * looking at their tiles. It is made from the block alone, so it only has
+ * what the block generation covers: tile types, designations and events.
+ */
+struct BlockSummary
+{
+    /// the generation of the block it was made for
+    uint32_t generation;
+    /// how many tiles are hidden
+    uint16_t hidden;
+
+    BlockSummary() : generation(0), hidden(0) {}
+
+    bool allHidden() const
+    {
+        return hidden == 256;
+    }
+};
+/**
+ * The summary of a block as of the last updateGenerations. Summaries are
+ * kept between suspensions, and one is only made again when the
+ * generation of its block changes. NULL where there is no block or
+ * updateGenerations hasn't seen it yet. Only call it while the game is
+ * suspended.
+ */
+extern DFHACK_EXPORT const BlockSummary * getBlockSummary(int32_t blockx, int32_t blocky, int32_t blockz);
+
+/*
+ * CONNECTED REGIONS
+ */
+
+/**
+ * Label the tiles a creature can stand on (floors, ramps and stairs) by
+ * the region they belong to. Tiles are connected to their four neighbours
+ * on a level, to the stair above or below if both stairs allow it, and a
+ * ramp to the four tiles around its top.
+ * Every block is labelled on its own by forEachBlock, and only again when
+ * its generation changes. The joins are kept between calls: a block that
+ * only gained floors, stairs or ramps is joined to its neighbours, and
+ * only the regions a block lost tiles or connections from are taken apart
+ * and joined again. Region ids can change with every call.
+ * Updates the generations. Only call it while the game is suspended.
+ * Returns the number of regions.
+ */
+extern DFHACK_EXPORT size_t updateRegions();
+/// the region of a tile as of the last updateRegions, 0 if nothing can stand there
+extern DFHACK_EXPORT uint32_t getRegion(int32_t x, int32_t y, int32_t z);
+/// can one walk from a to b, as of the last updateRegions
+extern DFHACK_EXPORT bool isConnected(DFCoord a, DFCoord b);
+/// all the tiles of a region, as of the last updateRegions. returns how many
+extern DFHACK_EXPORT size_t getRegionTiles(uint32_t region, std::vector<DFCoord> & tiles);
+
+/*
+ * VEINS
+ */
+
+/**
+ * Find the veins of the map: the mineral walls of one material that touch,
+ * diagonals included. The material of a tile is the last vein event of its
+ * block that covers it, like MapCache does it. A vein can also go on through
+ * the walls straight above and below it; updown = false keeps it to a level.
+ * Like the regions, a block is only looked at again when its generation
+ * changes, and the joins are kept between calls. Digging out a vein only
+ * takes that vein apart. Updates the generations. Only call it while the
+ * game is suspended. Returns the number of veins, over all levels.
+ */
+extern DFHACK_EXPORT size_t updateVeins();
+/**
+ * Bring the vein at a tile up to date without hashing the whole map. Only
+ * the blocks the vein has tiles in and the ones around them get new
+ * generations and labels, until the vein stops changing. The first call on
+ * a map does a whole updateVeins. Only call it while the game is
+ * suspended. Returns the vein of the tile, like getVein.
+ */
+extern DFHACK_EXPORT uint32_t updateVeinAt(int32_t x, int32_t y, int32_t z, bool updown = true);
+/// the vein of a tile as of the last updateVeins, 0 if it isn't a mineral wall
+extern DFHACK_EXPORT uint32_t getVein(int32_t x, int32_t y, int32_t z, bool updown = true);
+/// the inorganic material of a vein, -1 if there is no such vein
+extern DFHACK_EXPORT int16_t getVeinMaterial(uint32_t vein);
+/// how many tiles a vein has, as of the last updateVeins
+extern DFHACK_EXPORT size_t getVeinSize(uint32_t vein, bool updown = true);
+/// all the tiles of a vein, as of the last updateVeins. returns how many
+extern DFHACK_EXPORT size_t getVeinTiles(uint32_t vein, std::vector<DFCoord> & tiles, bool updown = true);
+
 /// copy the whole map block at block coords (see DFTypes.h for the block structure)
 extern DFHACK_EXPORT bool ReadBlock40d(uint32_t blockx, uint32_t blocky, uint32_t blockz, mapblock40d * buffer);
 
@@ -293,6 +452,28 @@ extern DFHACK_EXPORT bool WriteTemperatures (uint32_t blockx, uint32_t blocky, u
 extern DFHACK_EXPORT bool ReadOccupancy(uint32_t blockx, uint32_t blocky, uint32_t blockz, occupancies40d *buffer);
 extern DFHACK_EXPORT bool WriteOccupancy(uint32_t blockx, uint32_t blocky, uint32_t blockz, occupancies40d *buffer);
 
+/**
+ * Copy a box of tiles from min to max, both included, in tile coordinates.
+ * The buffer holds one value per tile, laid out like the block arrays:
+ * y changes fastest, then x, then z, so tile (x,y,z) is at
+ * ((z - min.z) * size_x + (x - min.x)) * size_y + (y - min.y).
+ * Block boundaries are handled inside, a run along y within a block is
+ * one memcpy. These go straight to the DF blocks, not through a MapCache.
+ * Returns false if the box isn't on the map, or if some of its blocks
+ * are missing. Missing blocks read as zeros and are not written.
+ */
+extern DFHACK_EXPORT bool ReadTileTypes(DFCoord min, DFCoord max, df::tiletype *buffer);
+extern DFHACK_EXPORT bool WriteTileTypes(DFCoord min, DFCoord max, const df::tiletype *buffer);
+extern DFHACK_EXPORT bool ReadDesignations(DFCoord min, DFCoord max, df::tile_designation *buffer);
+/// writes only the bits set in mask. Sets the dirty bit of the blocks if the mask has the dig bits
+extern DFHACK_EXPORT bool WriteDesignations(DFCoord min, DFCoord max, const df::tile_designation *buffer, uint32_t mask = 0xFFFFFFFF);
+extern DFHACK_EXPORT bool ReadOccupancy(DFCoord min, DFCoord max, df::tile_occupancy *buffer);
+/// writes only the bits set in mask
+extern DFHACK_EXPORT bool WriteOccupancy(DFCoord min, DFCoord max, const df::tile_occupancy *buffer, uint32_t mask = 0xFFFFFFFF);
+/// either buffer may be NULL
+extern DFHACK_EXPORT bool ReadTemperatures(DFCoord min, DFCoord max, uint16_t *temp1, uint16_t *temp2);
+extern DFHACK_EXPORT bool WriteTemperatures(DFCoord min, DFCoord max, const uint16_t *temp1, const uint16_t *temp2);
+
 /// copy/write the block dirty bit - this is used to mark a map block so that DF scans it for designated jobs like digging
 extern DFHACK_EXPORT bool ReadDirtyBit(uint32_t blockx, uint32_t blocky, uint32_t blockz, bool &dirtybit);
 extern DFHACK_EXPORT bool WriteDirtyBit(uint32_t blockx, uint32_t blocky, uint32_t blockz, bool dirtybit);
@@ -113,6 +113,9 @@ namespace DFHack
             return ptr ? decode(ptr->mat_type, ptr->mat_index) : decode(-1);
         }
 
+        /// Resolves a token like INORGANIC:IRON or PLANT:MUSHROOM_HELMET_PLUMP:WOOD.
+        /// Tokens looked for once, found or not, are remembered until the raws change.
+        /// A token that isn't found leaves the material as none.
         bool find(const std::string &token);
 
         bool findBuiltin(const std::string &token);
@@ -120,8 +123,10 @@ namespace DFHack
         bool findPlant(const std::string &token, const std::string &subtoken);
         bool findCreature(const std::string &token, const std::string &subtoken);
 
-        std::string getToken();
-        std::string toString(uint16_t temp = 10015, bool named = true);
+        /// Both are made once per material and kept, like the tokens find() resolved.
+        /// The strings stay valid until the raws change, copy them to keep them longer.
+        const std::string &getToken();
+        const std::string &toString(uint16_t temp = 10015, bool named = true);
 
         bool isAnyCloth();
 
@@ -141,6 +146,9 @@ namespace DFHack
         bool matches(const df::job_material_category &cat);
         bool matches(const df::dfhack_material_category &cat);
         bool matches(const df::job_item &item);
+
+    private:
+        bool findToken(const std::string &token);
     };
 
     DFHACK_EXPORT bool parseJobMaterialCategory(df::job_material_category *cat, const std::string &token);
@@ -30,6 +30,7 @@ distribution.
 #include <map>
 #include <set>
 #include <cstdlib>
+#include <algorithm>
 using namespace std;
 
 #include "modules/Maps.h"
@@ -38,6 +39,9 @@ using namespace std;
 #include "MemAccess.h"
 #include "ModuleFactory.h"
 #include "Core.h"
+#include "DirtyPages.h"
+#include "tinythread.h"
+#include "TileTypes.h"
 
 #include "DataDefs.h"
 #include "df/world_data.h"
@@ -131,6 +135,1345 @@ df::map_block *Maps::getBlockAbs (int32_t x, int32_t y, int32_t z)
     return world->map.block_index[x >> 4][y >> 4][z];
 }
 
+/*
+ * Parallel block passes
+ */
+
+namespace {
+    // see Features below
+    struct FeatureCache;
+    FeatureCache & readyFeatures();
+
+    // blocks taken from the shared counter at once. small enough to keep
+    // the workers busy until the end, big enough to not fight over the lock
+    const size_t BLOCK_BATCH = 64;
+
+    struct BlockQueue
+    {
+        tthread::mutex lock;
+        size_t next;
+        size_t count;
+    };
+
+    struct BlockWorker
+    {
+        BlockQueue * queue;
+        Maps::BlockVisitor * part;
+        size_t visited;
+    };
+
+    void visitBlocks(void * arg)
+    {
+        BlockWorker * worker = (BlockWorker *) arg;
+        BlockQueue * queue = worker->queue;
+        vector<df::map_block *> & blocks = world->map.map_blocks;
+        for (;;)
+        {
+            size_t start, end;
+            {
+                tthread::lock_guard<tthread::mutex> guard(queue->lock);
+                start = queue->next;
+                end = std::min(start + BLOCK_BATCH, queue->count);
+                queue->next = end;
+            }
+            if (start >= end)
+                break;
+            for (size_t i = start; i < end; i++)
+            {
+                if (blocks[i])
+                    worker->part->visit(blocks[i]);
+                worker->visited++;
+            }
+        }
+    }
+}
+
+size_t Maps::forEachBlock(Maps::BlockVisitor & visitor, int threads)
+{
+    if (!IsValid())
+        throw DFHack::Error::ModuleNotInitialized();
+
+    BlockQueue queue;
+    queue.next = 0;
+    queue.count = world->map.map_blocks.size();
+
+    if (threads <= 0)
+        threads = tthread::thread::hardware_concurrency();
+    size_t batches = (queue.count + BLOCK_BATCH - 1) / BLOCK_BATCH;
+    if (size_t(threads) > batches)
+        threads = batches;
+    if (threads < 1)
+        threads = 1;
+
+    // visitors may look features up from several threads at once
+    if (threads > 1 && world->world_data)
+        readyFeatures();
+
+    // the calling thread is worker 0 and does its share too
+    vector<BlockWorker> workers(threads);
+    vector<tthread::thread *> running;
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].queue = &queue;
+        workers[i].part = visitor.fork();
+        workers[i].visited = 0;
+    }
+    for (int i = 1; i < threads; i++)
+        running.push_back(new tthread::thread(visitBlocks, &workers[i]));
+    visitBlocks(&workers[0]);
+
+    size_t visited = 0;
+    for (size_t i = 0; i < running.size(); i++)
+    {
+        running[i]->join();
+        delete running[i];
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        visitor.merge(workers[i].part);
+        visited += workers[i].visited;
+        delete workers[i].part;
+    }
+    return visited;
+}
+
+/*
+ * Change detection
+ */
+
+namespace {
+    struct BlockStamp
+    {
+        df::map_block * block;
+        uint64_t hash;
+        uint32_t generation;
+        // listed in written_now
+        bool written;
+    };
+
+    // one per block position, x first, then y, then z
+    vector<BlockStamp> stamps;
+    // the map the stamps were made for, any other one starts over
+    void * stamped_index = 0;
+    int32_t stamped_x = 0, stamped_y = 0, stamped_z = 0;
+    uint32_t current_generation = 0;
+    // the DirtyPages frame of the last update, if it was tracking then
+    bool stamped_dirty = false;
+    uint32_t stamped_frame = 0;
+    // positions in stamps of the blocks DFHack wrote to since the last
+    // update. DirtyPages only sees them at the start of the next frame
+    vector<size_t> written_now;
+
+    // FNV-1a, a word at a time. not for anything but telling blocks apart
+    inline uint64_t hashWords(uint64_t hash, const void * data, size_t bytes)
+    {
+        const uint32_t * words = (const uint32_t *) data;
+        for (size_t i = 0; i < bytes / 4; i++)
+        {
+            hash ^= words[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    uint64_t hashBlock(df::map_block * block)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        hash = hashWords(hash, block->tiletype, sizeof(block->tiletype));
+        hash = hashWords(hash, block->designation, sizeof(block->designation));
+        hash = hashWords(hash, block->occupancy, sizeof(block->occupancy));
+        for (size_t i = 0; i < block->block_events.size(); i++)
+        {
+            df::block_square_event * evt = block->block_events[i];
+            uintptr_t id = (uintptr_t) evt;
+            uint32_t type = evt->getType();
+            hash = hashWords(hash, &id, sizeof(id));
+            hash = hashWords(hash, &type, sizeof(type));
+            if (type == block_square_event_type::mineral)
+            {
+                df::block_square_event_mineralst * vein = (df::block_square_event_mineralst *) evt;
+                hash = hashWords(hash, &vein->inorganic_mat, sizeof(vein->inorganic_mat));
+                hash = hashWords(hash, vein->tile_bitmask, sizeof(vein->tile_bitmask));
+            }
+        }
+        return hash;
+    }
+
+    // a new generation for the block if its hash changed
+    bool stampBlock(df::map_block * block, uint32_t generation)
+    {
+        int32_t x = block->map_pos.x >> 4, y = block->map_pos.y >> 4, z = block->map_pos.z;
+        if (x < 0 || y < 0 || z < 0 || x >= stamped_x || y >= stamped_y || z >= stamped_z)
+            return false;
+        BlockStamp & stamp = stamps[(z * stamped_y + y) * stamped_x + x];
+        uint64_t hash = hashBlock(block);
+        if (stamp.block == block && stamp.hash == hash)
+            return false;
+        stamp.block = block;
+        stamp.hash = hash;
+        stamp.generation = generation;
+        return true;
+    }
+
+    bool sameStampedMap()
+    {
+        return stamped_index == (void *) world->map.block_index &&
+               stamped_x == world->map.x_count_block &&
+               stamped_y == world->map.y_count_block &&
+               stamped_z == world->map.z_count_block;
+    }
+
+    // each block has its own stamp, so the workers never write the same one
+    struct BlockStamper : public Maps::BlockVisitor
+    {
+        uint32_t generation;
+        size_t changed;
+
+        BlockStamper(uint32_t generation) : generation(generation), changed(0) {}
+
+        Maps::BlockVisitor * fork()
+        {
+            return new BlockStamper(generation);
+        }
+        void visit(df::map_block * block)
+        {
+            if (stampBlock(block, generation))
+                changed++;
+        }
+        void merge(Maps::BlockVisitor * part)
+        {
+            changed += ((BlockStamper *) part)->changed;
+        }
+    };
+}
+
+uint32_t Maps::updateGenerations()
+{
+    if (!IsValid())
+        throw DFHack::Error::ModuleNotInitialized();
+
+    if (!sameStampedMap())
+    {
+        stamped_index = world->map.block_index;
+        stamped_x = world->map.x_count_block;
+        stamped_y = world->map.y_count_block;
+        stamped_z = world->map.z_count_block;
+        BlockStamp empty = { 0, 0, 0, false };
+        stamps.assign(size_t(stamped_x) * stamped_y * stamped_z, empty);
+        stamped_dirty = false;
+        written_now.clear();
+    }
+
+    // only use up a generation when something did change
+    BlockStamper stamper(current_generation + 1);
+    // with write tracking on, only the blocks DF wrote to need a look
+    DirtyPages * dirty = Core::getInstance().getDirtyPages();
+    vector<df::map_block *> written;
+    if (stamped_dirty && dirty->getChangedBlocks(stamped_frame, written))
+    {
+        for (size_t i = 0; i < written.size(); i++)
+            stamper.visit(written[i]);
+        for (size_t i = 0; i < written_now.size(); i++)
+        {
+            size_t pos = written_now[i];
+            df::map_block * block = getBlock(pos % stamped_x, (pos / stamped_x) % stamped_y,
+                                             pos / (size_t(stamped_x) * stamped_y));
+            if (block)
+                stamper.visit(block);
+        }
+    }
+    else
+        forEachBlock(stamper);
+    for (size_t i = 0; i < written_now.size(); i++)
+        stamps[written_now[i]].written = false;
+    written_now.clear();
+    stamped_dirty = dirty && dirty->isEnabled();
+    stamped_frame = dirty ? dirty->getFrame() : 0;
+    if (stamper.changed)
+        current_generation++;
+    return current_generation;
+}
+
+void Maps::markBlockWritten(df::map_block * block)
+{
+    // before the first update every block gets looked at anyway
+    if (!block || stamps.empty() || stamped_index != (void *) world->map.block_index)
+        return;
+    int32_t x = block->map_pos.x >> 4, y = block->map_pos.y >> 4, z = block->map_pos.z;
+    if (x < 0 || y < 0 || z < 0 || x >= stamped_x || y >= stamped_y || z >= stamped_z)
+        return;
+    size_t pos = (size_t(z) * stamped_y + y) * stamped_x + x;
+    if (stamps[pos].written)
+        return;
+    stamps[pos].written = true;
+    written_now.push_back(pos);
+}
+
+uint32_t Maps::getGeneration()
+{
+    return current_generation;
+}
+
+uint32_t Maps::getBlockGeneration(int32_t blockx, int32_t blocky, int32_t blockz)
+{
+    if ((blockx < 0) || (blocky < 0) || (blockz < 0))
+        return 0;
+    if ((blockx >= stamped_x) || (blocky >= stamped_y) || (blockz >= stamped_z))
+        return 0;
+    return stamps[(blockz * stamped_y + blocky) * stamped_x + blockx].generation;
+}
+
+uint32_t Maps::getChangedBlocks(uint32_t since, std::vector<df::map_block *> & changed)
+{
+    uint32_t generation = updateGenerations();
+    changed.clear();
+    for (size_t i = 0; i < stamps.size(); i++)
+    {
+        if (stamps[i].block && stamps[i].generation > since)
+            changed.push_back(stamps[i].block);
+    }
+    return generation;
+}
+
+/*
+ * Connected regions
+ */
+
+namespace {
+    /*
+     * The labels of all the blocks, joined over the whole map and kept joined
+     * between updates. Each block has a run of ids for its labels. A block
+     * that is labelled again gets a new run, and its old ids stay in their
+     * components as dead links until everything is joined from scratch.
+     */
+    struct Components
+    {
+        // union by size, 0 is nothing
+        vector<uint32_t> parent;
+        // the size of each id on its own, and at a root of the component
+        vector<uint32_t> weight;
+        vector<uint32_t> size;
+        // each component lists its ids from the root, dead ones included
+        vector<uint32_t> next;
+        vector<uint32_t> last;
+        // the block position an id was handed out for
+        vector<uint32_t> block;
+        size_t count;
+
+        Components() : count(0) {}
+
+        void clear(uint32_t ids)
+        {
+            parent.assign(ids, 0);
+            weight.assign(ids, 0);
+            size.assign(ids, 0);
+            next.assign(ids, 0);
+            last.assign(ids, 0);
+            block.assign(ids, 0);
+            count = 0;
+        }
+        void add(uint32_t id, uint32_t pos, uint32_t w)
+        {
+            if (id >= parent.size())
+            {
+                size_t grown = std::max(size_t(id) + 1, parent.size() * 2);
+                parent.resize(grown, 0);
+                weight.resize(grown, 0);
+                size.resize(grown, 0);
+                next.resize(grown, 0);
+                last.resize(grown, 0);
+                block.resize(grown, 0);
+            }
+            parent[id] = id;
+            weight[id] = size[id] = w;
+            next[id] = 0;
+            last[id] = id;
+            block[id] = pos;
+            count++;
+        }
+        uint32_t find(uint32_t id)
+        {
+            while (parent[id] != id)
+            {
+                parent[id] = parent[parent[id]];
+                id = parent[id];
+            }
+            return id;
+        }
+        void join(uint32_t a, uint32_t b)
+        {
+            if (!a || !b)
+                return;
+            a = find(a);
+            b = find(b);
+            if (a == b)
+                return;
+            if (size[a] < size[b])
+                std::swap(a, b);
+            parent[b] = a;
+            size[a] += size[b];
+            next[last[a]] = b;
+            last[a] = last[b];
+            count--;
+        }
+    };
+
+    // what the joins need to know about the labels of one kind of index
+    struct BlockJoiner
+    {
+        virtual ~BlockJoiner() {}
+        // is the id still in the run of its block
+        virtual bool live(Components & c, uint32_t id) = 0;
+        // join a block to its neighbours. all = false only joins it to the
+        // blocks east, south and above, which is enough when joining them all
+        virtual void joinBlock(Components & c, uint32_t pos, bool all) = 0;
+    };
+
+    /*
+     * Brings the components up to date after some blocks got new runs of
+     * ids, already added to c. The components the ids in 'gone' were in may
+     * have come apart, so they are taken apart and the blocks they have ids
+     * in are joined again. 'kept' pairs an old id with the new one that has
+     * all of its tiles now. Everything else only needs the changed blocks
+     * joined to their neighbours.
+     */
+    void rejoin(Components & c, BlockJoiner & joiner, const vector<uint32_t> & changed,
+                const vector<uint32_t> & gone, const vector< pair<uint32_t, uint32_t> > & kept)
+    {
+        std::set<uint32_t> roots;
+        for (size_t i = 0; i < gone.size(); i++)
+            roots.insert(c.find(gone[i]));
+        vector< pair<uint32_t, uint32_t> > keep;
+        for (size_t i = 0; i < kept.size(); i++)
+        {
+            uint32_t root = c.find(kept[i].first);
+            if (roots.count(root))
+                continue;
+            // the new id brings the tiles along
+            c.size[root] -= c.weight[kept[i].first];
+            c.weight[kept[i].first] = 0;
+            keep.push_back(make_pair(root, kept[i].second));
+        }
+        vector<uint32_t> apart;
+        for (std::set<uint32_t>::iterator it = roots.begin(); it != roots.end(); ++it)
+        {
+            for (uint32_t id = *it; id; id = c.next[id])
+                if (joiner.live(c, id))
+                    apart.push_back(id);
+        }
+        c.count -= roots.size();
+        vector<uint32_t> blocks(changed);
+        for (size_t i = 0; i < apart.size(); i++)
+        {
+            uint32_t pos = c.block[apart[i]];
+            c.add(apart[i], pos, c.weight[apart[i]]);
+            blocks.push_back(pos);
+        }
+        for (size_t i = 0; i < keep.size(); i++)
+            c.join(keep[i].first, keep[i].second);
+        sort(blocks.begin(), blocks.end());
+        blocks.erase(unique(blocks.begin(), blocks.end()), blocks.end());
+        for (size_t i = 0; i < blocks.size(); i++)
+            joiner.joinBlock(c, blocks[i], true);
+    }
+
+    struct BlockRegions
+    {
+        df::map_block * block;
+        uint32_t generation;
+        // id of label 1, minus one
+        uint32_t first;
+        uint32_t count;
+        // 0 where nothing can stand
+        uint8_t labels[16][16];
+        // bit x of row y: stairs up, stairs down, ramps
+        uint16_t up[16];
+        uint16_t down[16];
+        uint16_t ramps[16];
+    };
+
+    // laid out like the stamps
+    vector<BlockRegions> regions;
+    void * labelled_index = 0;
+    Components region_ids;
+    // ids handed out so far, and how many are still in the run of a block
+    uint32_t region_next = 0;
+    uint32_t region_live = 0;
+
+    // the labels are made for 4 neighbours, so a block has at most 128
+    void labelBlock(df::map_block * block, BlockRegions & r)
+    {
+        bool stand[16][16];
+        memset(r.labels, 0, sizeof(r.labels));
+        for (int y = 0; y < 16; y++)
+        {
+            r.up[y] = r.down[y] = r.ramps[y] = 0;
+            for (int x = 0; x < 16; x++)
+            {
+                df::tiletype tt = block->tiletype[x][y];
+                df::tiletype_shape_basic basic = ENUM_ATTR(tiletype_shape, basic_shape, tileShape(tt));
+                stand[x][y] = basic == tiletype_shape_basic::Floor ||
+                              basic == tiletype_shape_basic::Ramp ||
+                              basic == tiletype_shape_basic::Stair;
+                if (basic == tiletype_shape_basic::Stair)
+                {
+                    if (HighPassable(tt))
+                        r.up[y] |= 1 << x;
+                    if (LowPassable(tt))
+                        r.down[y] |= 1 << x;
+                }
+                else if (basic == tiletype_shape_basic::Ramp)
+                    r.ramps[y] |= 1 << x;
+            }
+        }
+        r.count = 0;
+        uint8_t queue[256];
+        for (int x = 0; x < 16; x++)
+        {
+            for (int y = 0; y < 16; y++)
+            {
+                if (!stand[x][y] || r.labels[x][y])
+                    continue;
+                uint8_t label = ++r.count;
+                int head = 0, tail = 0;
+                r.labels[x][y] = label;
+                queue[tail++] = x << 4 | y;
+                while (head < tail)
+                {
+                    int tx = queue[head] >> 4, ty = queue[head] & 15;
+                    head++;
+                    const int dx[] = { -1, 1, 0, 0 }, dy[] = { 0, 0, -1, 1 };
+                    for (int i = 0; i < 4; i++)
+                    {
+                        int nx = tx + dx[i], ny = ty + dy[i];
+                        if (nx < 0 || ny < 0 || nx > 15 || ny > 15)
+                            continue;
+                        if (!stand[nx][ny] || r.labels[nx][ny])
+                            continue;
+                        r.labels[nx][ny] = label;
+                        queue[tail++] = nx << 4 | ny;
+                    }
+                }
+            }
+        }
+    }
+
+    // each block has its own entry, like the stamps. with keep, the blocks
+    // labelled again are listed with what they had before
+    struct BlockLabeller : public Maps::BlockVisitor
+    {
+        bool keep;
+        vector< pair<uint32_t, BlockRegions> > relabelled;
+
+        BlockLabeller(bool keep) : keep(keep) {}
+
+        Maps::BlockVisitor * fork()
+        {
+            return new BlockLabeller(keep);
+        }
+        void visit(df::map_block * block)
+        {
+            int32_t x = block->map_pos.x >> 4, y = block->map_pos.y >> 4, z = block->map_pos.z;
+            if (x < 0 || y < 0 || z < 0 || x >= stamped_x || y >= stamped_y || z >= stamped_z)
+                return;
+            size_t index = (z * stamped_y + y) * stamped_x + x;
+            BlockRegions & r = regions[index];
+            uint32_t generation = stamps[index].generation;
+            if (r.block == block && r.generation == generation)
+                return;
+            if (keep)
+                relabelled.push_back(make_pair(uint32_t(index), r));
+            labelBlock(block, r);
+            r.block = block;
+            r.generation = generation;
+        }
+        void merge(Maps::BlockVisitor * part)
+        {
+            vector< pair<uint32_t, BlockRegions> > & more = ((BlockLabeller *) part)->relabelled;
+            relabelled.insert(relabelled.end(), more.begin(), more.end());
+        }
+    };
+
+    // the id of a tile, 0 if nothing stands there
+    uint32_t labelId(int32_t x, int32_t y, int32_t z)
+    {
+        if (x < 0 || y < 0 || z < 0)
+            return 0;
+        if (x >= stamped_x * 16 || y >= stamped_y * 16 || z >= stamped_z)
+            return 0;
+        BlockRegions & r = regions[(z * stamped_y + (y >> 4)) * stamped_x + (x >> 4)];
+        uint8_t label = r.labels[x & 15][y & 15];
+        return label ? r.first + label : 0;
+    }
+
+    struct RegionJoiner : public BlockJoiner
+    {
+        bool live(Components & c, uint32_t id)
+        {
+            BlockRegions & r = regions[c.block[id]];
+            return id > r.first && id <= r.first + r.count;
+        }
+        void joinBlock(Components & c, uint32_t pos, bool all)
+        {
+            BlockRegions & r = regions[pos];
+            if (!r.count)
+                return;
+            int32_t bx = pos % stamped_x, by = (pos / stamped_x) % stamped_y;
+            int32_t z = pos / (stamped_x * stamped_y);
+            int32_t x0 = bx * 16, y0 = by * 16;
+            // the edges to the next blocks east and south
+            for (int i = 0; i < 16; i++)
+            {
+                if (r.labels[15][i])
+                    c.join(r.first + r.labels[15][i], labelId(x0 + 16, y0 + i, z));
+                if (r.labels[i][15])
+                    c.join(r.first + r.labels[i][15], labelId(x0 + i, y0 + 16, z));
+                if (!all)
+                    continue;
+                if (r.labels[0][i])
+                    c.join(r.first + r.labels[0][i], labelId(x0 - 1, y0 + i, z));
+                if (r.labels[i][0])
+                    c.join(r.first + r.labels[i][0], labelId(x0 + i, y0 - 1, z));
+            }
+            if (z + 1 < stamped_z)
+            {
+                BlockRegions & above = regions[pos + stamped_x * stamped_y];
+                for (int y = 0; y < 16; y++)
+                {
+                    uint16_t stairs = r.up[y] & above.down[y];
+                    uint16_t ramps = r.ramps[y];
+                    if (!stairs && !ramps)
+                        continue;
+                    for (int x = 0; x < 16; x++)
+                    {
+                        uint32_t id = r.first + r.labels[x][y];
+                        if (stairs & (1 << x))
+                            c.join(id, above.first + above.labels[x][y]);
+                        if (ramps & (1 << x))
+                        {
+                            c.join(id, labelId(x0 + x - 1, y0 + y, z + 1));
+                            c.join(id, labelId(x0 + x + 1, y0 + y, z + 1));
+                            c.join(id, labelId(x0 + x, y0 + y - 1, z + 1));
+                            c.join(id, labelId(x0 + x, y0 + y + 1, z + 1));
+                        }
+                    }
+                }
+            }
+            if (!all || z == 0)
+                return;
+            // the stairs below, and the ramps below with their tops on this block
+            BlockRegions & below = regions[pos - stamped_x * stamped_y];
+            for (int y = 0; y < 16; y++)
+            {
+                uint16_t stairs = below.up[y] & r.down[y];
+                for (int x = 0; stairs && x < 16; x++)
+                    if (stairs & (1 << x))
+                        c.join(r.first + r.labels[x][y], below.first + below.labels[x][y]);
+            }
+            for (int32_t ny = by - 1; ny <= by + 1; ny++)
+            for (int32_t nx = bx - 1; nx <= bx + 1; nx++)
+            {
+                if (nx < 0 || ny < 0 || nx >= stamped_x || ny >= stamped_y)
+                    continue;
+                BlockRegions & low = regions[((z - 1) * stamped_y + ny) * stamped_x + nx];
+                for (int y = 0; y < 16; y++)
+                {
+                    if (!low.ramps[y])
+                        continue;
+                    for (int x = 0; x < 16; x++)
+                    {
+                        if (!(low.ramps[y] & (1 << x)))
+                            continue;
+                        int32_t rx = nx * 16 + x, ry = ny * 16 + y;
+                        const int dx[] = { -1, 1, 0, 0 }, dy[] = { 0, 0, -1, 1 };
+                        for (int i = 0; i < 4; i++)
+                        {
+                            int32_t tx = rx + dx[i], ty = ry + dy[i];
+                            if ((tx >> 4) == bx && (ty >> 4) == by)
+                                c.join(low.first + low.labels[x][y], labelId(tx, ty, z));
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // false before the first update and after the map changed
+    bool haveRegions()
+    {
+        return !region_ids.parent.empty() && labelled_index == stamped_index && regions.size() == stamps.size();
+    }
+
+    // hands out the ids again from 1, without the dead ones
+    void joinAllRegions()
+    {
+        region_next = 0;
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            regions[i].first = region_next;
+            region_next += regions[i].count;
+        }
+        region_live = region_next;
+        region_ids.clear(region_next + 1);
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            for (uint32_t j = 1; j <= regions[i].count; j++)
+                region_ids.add(regions[i].first + j, i, 1);
+        }
+        RegionJoiner joiner;
+        for (size_t i = 0; i < regions.size(); i++)
+            joiner.joinBlock(region_ids, i, false);
+    }
+
+    bool sameRegions(const BlockRegions & a, const BlockRegions & b)
+    {
+        return a.count == b.count &&
+               !memcmp(a.labels, b.labels, sizeof(a.labels)) &&
+               !memcmp(a.up, b.up, sizeof(a.up)) &&
+               !memcmp(a.down, b.down, sizeof(a.down)) &&
+               !memcmp(a.ramps, b.ramps, sizeof(a.ramps));
+    }
+
+    /*
+     * Gives the relabelled blocks new ids. A block that only gained
+     * standing room, stairs and ramps can't split anything, so its old
+     * labels are kept joined to the new ones that took their tiles. Only
+     * the regions of a block that lost some are taken apart.
+     */
+    void joinRelabelled(vector< pair<uint32_t, BlockRegions> > & relabelled)
+    {
+        vector<uint32_t> changed, gone;
+        vector< pair<uint32_t, uint32_t> > kept;
+        for (size_t i = 0; i < relabelled.size(); i++)
+        {
+            uint32_t pos = relabelled[i].first;
+            BlockRegions & old = relabelled[i].second;
+            BlockRegions & r = regions[pos];
+            if (sameRegions(old, r))
+            {
+                r.first = old.first;
+                continue;
+            }
+            r.first = region_next;
+            region_next += r.count;
+            region_live += r.count;
+            region_live -= old.count;
+            for (uint32_t j = 1; j <= r.count; j++)
+                region_ids.add(r.first + j, pos, 1);
+            changed.push_back(pos);
+
+            bool grew = true;
+            for (int y = 0; y < 16; y++)
+                if ((old.up[y] & ~r.up[y]) || (old.down[y] & ~r.down[y]) || (old.ramps[y] & ~r.ramps[y]))
+                    grew = false;
+            uint8_t moved[129] = { 0 };
+            for (int x = 0; grew && x < 16; x++)
+            {
+                for (int y = 0; y < 16; y++)
+                {
+                    if (!old.labels[x][y])
+                        continue;
+                    if (!r.labels[x][y])
+                        grew = false;
+                    moved[old.labels[x][y]] = r.labels[x][y];
+                }
+            }
+            for (uint32_t j = 1; j <= old.count; j++)
+            {
+                if (grew)
+                    kept.push_back(make_pair(old.first + j, r.first + moved[j]));
+                else
+                    gone.push_back(old.first + j);
+            }
+        }
+        if (changed.empty())
+            return;
+        RegionJoiner joiner;
+        rejoin(region_ids, joiner, changed, gone, kept);
+    }
+}
+
+size_t Maps::updateRegions()
+{
+    updateGenerations();
+    bool fresh = false;
+    if (labelled_index != stamped_index || regions.size() != stamps.size())
+    {
+        labelled_index = stamped_index;
+        BlockRegions empty;
+        memset(&empty, 0, sizeof(empty));
+        regions.assign(stamps.size(), empty);
+        fresh = true;
+    }
+    // start over once the dead ids outnumber the live ones
+    bool all = fresh || region_next - region_live > region_live + (1 << 16);
+    BlockLabeller labeller(!all);
+    forEachBlock(labeller);
+    if (all)
+        joinAllRegions();
+    else
+        joinRelabelled(labeller.relabelled);
+    return region_ids.count;
+}
+
+uint32_t Maps::getRegion(int32_t x, int32_t y, int32_t z)
+{
+    if (!haveRegions())
+        return 0;
+    return region_ids.find(labelId(x, y, z));
+}
+
+bool Maps::isConnected(DFCoord a, DFCoord b)
+{
+    uint32_t region = getRegion(a.x, a.y, a.z);
+    return region && region == getRegion(b.x, b.y, b.z);
+}
+
+size_t Maps::getRegionTiles(uint32_t region, std::vector<DFCoord> & tiles)
+{
+    tiles.clear();
+    if (!region || !haveRegions() || region >= region_ids.parent.size())
+        return 0;
+    // the runs of a block are contiguous, so sorted ids come a block at a time
+    RegionJoiner joiner;
+    vector<uint32_t> members;
+    for (uint32_t id = region_ids.find(region); id; id = region_ids.next[id])
+        if (joiner.live(region_ids, id))
+            members.push_back(id);
+    sort(members.begin(), members.end());
+    for (size_t i = 0; i < members.size();)
+    {
+        uint32_t pos = region_ids.block[members[i]];
+        BlockRegions & r = regions[pos];
+        bool in[129] = { false };
+        for (; i < members.size() && region_ids.block[members[i]] == pos; i++)
+            in[members[i] - r.first] = true;
+        int32_t bx = pos % stamped_x, by = (pos / stamped_x) % stamped_y;
+        int32_t z = pos / (stamped_x * stamped_y);
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 16; y++)
+                if (in[r.labels[x][y]])
+                    tiles.push_back(DFCoord(bx * 16 + x, by * 16 + y, z));
+    }
+    return tiles.size();
+}
+
+/*
+ * Veins
+ */
+
+namespace {
+    struct BlockVeins
+    {
+        df::map_block * block;
+        uint32_t generation;
+        // id of label 1, minus one
+        uint32_t first;
+        uint32_t count;
+        // 0 where there is no mineral wall, empty if the block has no veins
+        vector<uint16_t> labels;
+        // material and number of tiles of each label
+        vector<int16_t> mats;
+        vector<uint16_t> sizes;
+
+        BlockVeins() : block(0), generation(0), first(0), count(0) {}
+    };
+
+    // laid out like the stamps
+    vector<BlockVeins> vein_blocks;
+    void * veined_index = 0;
+    // the labels joined on their level, and joined across levels too
+    Components level_veins;
+    Components body_veins;
+    // material of every id
+    vector<int16_t> vein_mats;
+    // ids handed out so far, and how many are still in the run of a block
+    uint32_t vein_next = 0;
+    uint32_t vein_live = 0;
+
+    // neighbours touching diagonally belong together, so with different
+    // materials next to each other a block can have all of 256 labels
+    void labelVeins(df::map_block * block, BlockVeins & v)
+    {
+        int16_t mats[16][16];
+        uint16_t mineral[16];
+        bool any = false;
+        for (int y = 0; y < 16; y++)
+        {
+            mineral[y] = 0;
+            for (int x = 0; x < 16; x++)
+            {
+                df::tiletype tt = block->tiletype[x][y];
+                if (isWallTerrain(tt) && tileMaterial(tt) == tiletype_material::MINERAL)
+                    mineral[y] |= 1 << x;
+                mats[x][y] = -1;
+            }
+            any |= mineral[y] != 0;
+        }
+        v.count = 0;
+        v.labels.clear();
+        v.mats.clear();
+        v.sizes.clear();
+        if (!any)
+            return;
+        // the last event covering a tile decides its material
+        uint16_t open[16];
+        memcpy(open, mineral, sizeof(open));
+        for (int i = (int) block->block_events.size() - 1; i >= 0; i--)
+        {
+            df::block_square_event * evt = block->block_events[i];
+            if (evt->getType() != block_square_event_type::mineral)
+                continue;
+            df::block_square_event_mineralst * vein = (df::block_square_event_mineralst *) evt;
+            for (int y = 0; y < 16; y++)
+            {
+                uint16_t covered = open[y] & vein->tile_bitmask[y];
+                if (!covered)
+                    continue;
+                open[y] &= ~covered;
+                for (int x = 0; x < 16; x++)
+                    if (covered & (1 << x))
+                        mats[x][y] = vein->inorganic_mat;
+            }
+        }
+
+        v.labels.assign(256, 0);
+        uint8_t queue[256];
+        for (int x = 0; x < 16; x++)
+        {
+            for (int y = 0; y < 16; y++)
+            {
+                if (mats[x][y] == -1 || v.labels[x * 16 + y])
+                    continue;
+                int16_t mat = mats[x][y];
+                uint16_t label = ++v.count;
+                uint16_t size = 0;
+                int head = 0, tail = 0;
+                v.labels[x * 16 + y] = label;
+                queue[tail++] = x << 4 | y;
+                while (head < tail)
+                {
+                    int tx = queue[head] >> 4, ty = queue[head] & 15;
+                    head++;
+                    size++;
+                    for (int nx = tx - 1; nx <= tx + 1; nx++)
+                    {
+                        for (int ny = ty - 1; ny <= ty + 1; ny++)
+                        {
+                            if (nx < 0 || ny < 0 || nx > 15 || ny > 15)
+                                continue;
+                            if (mats[nx][ny] != mat || v.labels[nx * 16 + ny])
+                                continue;
+                            v.labels[nx * 16 + ny] = label;
+                            queue[tail++] = nx << 4 | ny;
+                        }
+                    }
+                }
+                v.mats.push_back(mat);
+                v.sizes.push_back(size);
+            }
+        }
+    }
+
+    // each block has its own entry, like the stamps. with keep, the blocks
+    // labelled again are listed with what they had before
+    struct VeinLabeller : public Maps::BlockVisitor
+    {
+        bool keep;
+        vector< pair<uint32_t, BlockVeins> > relabelled;
+
+        VeinLabeller(bool keep) : keep(keep) {}
+
+        Maps::BlockVisitor * fork()
+        {
+            return new VeinLabeller(keep);
+        }
+        void visit(df::map_block * block)
+        {
+            int32_t x = block->map_pos.x >> 4, y = block->map_pos.y >> 4, z = block->map_pos.z;
+            if (x < 0 || y < 0 || z < 0 || x >= stamped_x || y >= stamped_y || z >= stamped_z)
+                return;
+            size_t index = (z * stamped_y + y) * stamped_x + x;
+            BlockVeins & v = vein_blocks[index];
+            uint32_t generation = stamps[index].generation;
+            if (v.block == block && v.generation == generation)
+                return;
+            if (keep)
+                relabelled.push_back(make_pair(uint32_t(index), v));
+            labelVeins(block, v);
+            v.block = block;
+            v.generation = generation;
+        }
+        void merge(Maps::BlockVisitor * part)
+        {
+            vector< pair<uint32_t, BlockVeins> > & more = ((VeinLabeller *) part)->relabelled;
+            relabelled.insert(relabelled.end(), more.begin(), more.end());
+        }
+    };
+
+    // the id of a tile, 0 if it isn't in a vein
+    uint32_t veinLabelId(int32_t x, int32_t y, int32_t z)
+    {
+        if (x < 0 || y < 0 || z < 0)
+            return 0;
+        if (x >= stamped_x * 16 || y >= stamped_y * 16 || z >= stamped_z)
+            return 0;
+        BlockVeins & v = vein_blocks[(z * stamped_y + (y >> 4)) * stamped_x + (x >> 4)];
+        if (!v.count)
+            return 0;
+        uint16_t label = v.labels[(x & 15) * 16 + (y & 15)];
+        return label ? v.first + label : 0;
+    }
+
+    // only the same material makes one vein
+    void joinVeins(Components & c, uint32_t a, uint32_t b)
+    {
+        if (a && b && vein_mats[a] == vein_mats[b])
+            c.join(a, b);
+    }
+
+    struct VeinJoiner : public BlockJoiner
+    {
+        // join the walls straight above and below too
+        bool updown;
+
+        VeinJoiner(bool updown) : updown(updown) {}
+
+        bool live(Components & c, uint32_t id)
+        {
+            BlockVeins & v = vein_blocks[c.block[id]];
+            return id > v.first && id <= v.first + v.count;
+        }
+        void joinBlock(Components & c, uint32_t pos, bool all)
+        {
+            BlockVeins & v = vein_blocks[pos];
+            if (!v.count)
+                return;
+            int32_t bx = pos % stamped_x, by = (pos / stamped_x) % stamped_y;
+            int32_t z = pos / (stamped_x * stamped_y);
+            int32_t x0 = bx * 16, y0 = by * 16;
+            // along the edges to the blocks around, with their corners
+            for (int i = 0; i < 16; i++)
+            {
+                uint16_t east = v.labels[15 * 16 + i];
+                uint16_t south = v.labels[i * 16 + 15];
+                uint16_t west = all ? v.labels[i] : 0;
+                uint16_t north = all ? v.labels[i * 16] : 0;
+                for (int d = -1; d <= 1; d++)
+                {
+                    if (east)
+                        joinVeins(c, v.first + east, veinLabelId(x0 + 16, y0 + i + d, z));
+                    if (south)
+                        joinVeins(c, v.first + south, veinLabelId(x0 + i + d, y0 + 16, z));
+                    if (west)
+                        joinVeins(c, v.first + west, veinLabelId(x0 - 1, y0 + i + d, z));
+                    if (north)
+                        joinVeins(c, v.first + north, veinLabelId(x0 + i + d, y0 - 1, z));
+                }
+            }
+            if (!updown)
+                return;
+            // then straight up, and down
+            for (int32_t nz = z + 1; nz >= (all ? z - 1 : z + 1); nz -= 2)
+            {
+                if (nz < 0 || nz >= stamped_z)
+                    continue;
+                BlockVeins & w = vein_blocks[(nz * stamped_y + by) * stamped_x + bx];
+                if (!w.count)
+                    continue;
+                for (int i = 0; i < 256; i++)
+                {
+                    if (v.labels[i] && w.labels[i])
+                        joinVeins(c, v.first + v.labels[i], w.first + w.labels[i]);
+                }
+            }
+        }
+    };
+
+    // false before the first update and after the map changed
+    bool haveVeins()
+    {
+        return !body_veins.parent.empty() && veined_index == stamped_index && vein_blocks.size() == stamps.size();
+    }
+
+    void addVeinIds(uint32_t pos)
+    {
+        BlockVeins & v = vein_blocks[pos];
+        if (vein_mats.size() <= v.first + v.count)
+            vein_mats.resize(std::max(size_t(v.first + v.count) + 1, vein_mats.size() * 2), -1);
+        for (uint32_t j = 1; j <= v.count; j++)
+        {
+            vein_mats[v.first + j] = v.mats[j - 1];
+            level_veins.add(v.first + j, pos, v.sizes[j - 1]);
+            body_veins.add(v.first + j, pos, v.sizes[j - 1]);
+        }
+    }
+
+    // hands out the ids again from 1, without the dead ones
+    void joinAllVeins()
+    {
+        vein_next = 0;
+        for (size_t i = 0; i < vein_blocks.size(); i++)
+        {
+            vein_blocks[i].first = vein_next;
+            vein_next += vein_blocks[i].count;
+        }
+        vein_live = vein_next;
+        vein_mats.assign(vein_next + 1, -1);
+        level_veins.clear(vein_next + 1);
+        body_veins.clear(vein_next + 1);
+        for (size_t i = 0; i < vein_blocks.size(); i++)
+            addVeinIds(i);
+        VeinJoiner level(false), body(true);
+        for (size_t i = 0; i < vein_blocks.size(); i++)
+        {
+            level.joinBlock(level_veins, i, false);
+            body.joinBlock(body_veins, i, false);
+        }
+    }
+
+    /*
+     * Like the regions: a block that only gained walls of the materials it
+     * had keeps its old labels joined to the new ones, and only the veins
+     * of a block that lost some are taken apart. Digging a vein only takes
+     * that vein apart.
+     */
+    void joinRelabelledVeins(vector< pair<uint32_t, BlockVeins> > & relabelled)
+    {
+        vector<uint32_t> changed, gone;
+        vector< pair<uint32_t, uint32_t> > kept;
+        for (size_t i = 0; i < relabelled.size(); i++)
+        {
+            uint32_t pos = relabelled[i].first;
+            BlockVeins & old = relabelled[i].second;
+            BlockVeins & v = vein_blocks[pos];
+            if (old.count == v.count && old.labels == v.labels && old.mats == v.mats)
+            {
+                v.first = old.first;
+                continue;
+            }
+            v.first = vein_next;
+            vein_next += v.count;
+            vein_live += v.count;
+            vein_live -= old.count;
+            addVeinIds(pos);
+            changed.push_back(pos);
+
+            bool grew = true;
+            vector<uint16_t> moved(old.count + 1, 0);
+            for (size_t t = 0; grew && t < old.labels.size(); t++)
+            {
+                uint16_t label = old.labels[t];
+                if (!label)
+                    continue;
+                if (!v.count || !v.labels[t] || v.mats[v.labels[t] - 1] != old.mats[label - 1])
+                    grew = false;
+                else
+                    moved[label] = v.labels[t];
+            }
+            for (uint32_t j = 1; j <= old.count; j++)
+            {
+                if (grew)
+                    kept.push_back(make_pair(old.first + j, v.first + moved[j]));
+                else
+                    gone.push_back(old.first + j);
+            }
+        }
+        if (changed.empty())
+            return;
+        VeinJoiner level(false), body(true);
+        rejoin(level_veins, level, changed, gone, kept);
+        rejoin(body_veins, body, changed, gone, kept);
+    }
+}
+
+size_t Maps::updateVeins()
+{
+    updateGenerations();
+    bool fresh = false;
+    if (veined_index != stamped_index || vein_blocks.size() != stamps.size())
+    {
+        veined_index = stamped_index;
+        vein_blocks.assign(stamps.size(), BlockVeins());
+        fresh = true;
+    }
+    // start over once the dead ids outnumber the live ones
+    bool all = fresh || vein_next - vein_live > vein_live + (1 << 16);
+    VeinLabeller labeller(!all);
+    forEachBlock(labeller);
+    if (all)
+        joinAllVeins();
+    else
+        joinRelabelledVeins(labeller.relabelled);
+    return body_veins.count;
+}
+
+uint32_t Maps::updateVeinAt(int32_t x, int32_t y, int32_t z, bool updown)
+{
+    if (!IsValid())
+        throw DFHack::Error::ModuleNotInitialized();
+    if (!haveVeins() || !sameStampedMap())
+    {
+        updateVeins();
+        return getVein(x, y, z, updown);
+    }
+    if (x < 0 || y < 0 || z < 0 || x >= stamped_x * 16 || y >= stamped_y * 16 || z >= stamped_z)
+        return 0;
+
+    std::set<uint32_t> looked;
+    bool stamped = false;
+    for (;;)
+    {
+        // the block of the tile and the ones its vein has tiles in
+        vector<uint32_t> centres;
+        centres.push_back((z * stamped_y + (y >> 4)) * stamped_x + (x >> 4));
+        VeinJoiner joiner(true);
+        for (uint32_t id = body_veins.find(veinLabelId(x, y, z)); id; id = body_veins.next[id])
+            if (joiner.live(body_veins, id))
+                centres.push_back(body_veins.block[id]);
+        sort(centres.begin(), centres.end());
+        centres.erase(unique(centres.begin(), centres.end()), centres.end());
+
+        // look at them and everything around them, a block only once
+        VeinLabeller labeller(true);
+        for (size_t i = 0; i < centres.size(); i++)
+        {
+            int32_t bx = centres[i] % stamped_x, by = (centres[i] / stamped_x) % stamped_y;
+            int32_t bz = centres[i] / (stamped_x * stamped_y);
+            for (int32_t nz = bz - 1; nz <= bz + 1; nz++)
+            for (int32_t ny = by - 1; ny <= by + 1; ny++)
+            for (int32_t nx = bx - 1; nx <= bx + 1; nx++)
+            {
+                if (nx < 0 || ny < 0 || nz < 0 || nx >= stamped_x || ny >= stamped_y || nz >= stamped_z)
+                    continue;
+                if (!looked.insert((nz * stamped_y + ny) * stamped_x + nx).second)
+                    continue;
+                df::map_block * block = getBlock(nx, ny, nz);
+                if (!block)
+                    continue;
+                if (stampBlock(block, current_generation + 1))
+                    stamped = true;
+                labeller.visit(block);
+            }
+        }
+        // a changed vein can reach blocks that weren't looked at yet
+        if (labeller.relabelled.empty())
+            break;
+        joinRelabelledVeins(labeller.relabelled);
+    }
+    if (stamped)
+        current_generation++;
+    return getVein(x, y, z, updown);
+}
+
+uint32_t Maps::getVein(int32_t x, int32_t y, int32_t z, bool updown)
+{
+    if (!haveVeins())
+        return 0;
+    uint32_t id = veinLabelId(x, y, z);
+    return updown ? body_veins.find(id) : level_veins.find(id);
+}
+
+int16_t Maps::getVeinMaterial(uint32_t vein)
+{
+    if (!haveVeins() || vein >= vein_mats.size())
+        return -1;
+    return vein_mats[vein];
+}
+
+size_t Maps::getVeinSize(uint32_t vein, bool updown)
+{
+    Components & c = updown ? body_veins : level_veins;
+    if (!vein || !haveVeins() || vein >= c.parent.size())
+        return 0;
+    return c.size[c.find(vein)];
+}
+
+size_t Maps::getVeinTiles(uint32_t vein, std::vector<DFCoord> & tiles, bool updown)
+{
+    tiles.clear();
+    Components & c = updown ? body_veins : level_veins;
+    if (!vein || !haveVeins() || vein >= c.parent.size())
+        return 0;
+    // the runs of a block are contiguous, so sorted ids come a block at a time
+    VeinJoiner joiner(updown);
+    vector<uint32_t> members;
+    for (uint32_t id = c.find(vein); id; id = c.next[id])
+        if (joiner.live(c, id))
+            members.push_back(id);
+    sort(members.begin(), members.end());
+    for (size_t i = 0; i < members.size();)
+    {
+        uint32_t pos = c.block[members[i]];
+        BlockVeins & v = vein_blocks[pos];
+        bool in[257] = { false };
+        for (; i < members.size() && c.block[members[i]] == pos; i++)
+            in[members[i] - v.first] = true;
+        int32_t bx = pos % stamped_x, by = (pos / stamped_x) % stamped_y;
+        int32_t z = pos / (stamped_x * stamped_y);
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 16; y++)
+                if (in[v.labels[x * 16 + y]])
+                    tiles.push_back(DFCoord(bx * 16 + x, by * 16 + y, z));
+    }
+    return tiles.size();
+}
+
+/*
+ * Block summaries
+ */
+
+namespace {
+    struct SummaryEntry
+    {
+        df::map_block * block;
+        Maps::BlockSummary summary;
+
+        SummaryEntry() : block(0) {}
+    };
+
+    // laid out like the stamps
+    vector<SummaryEntry> summaries;
+    void * summarized_index = 0;
+
+    void summarizeBlock(df::map_block * block, Maps::BlockSummary & sum)
+    {
+        sum.hidden = 0;
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 16; y++)
+                if (block->designation[x][y].bits.hidden)
+                    sum.hidden++;
+    }
+}
+
+const Maps::BlockSummary * Maps::getBlockSummary(int32_t blockx, int32_t blocky, int32_t blockz)
+{
+    if (!IsValid() || !sameStampedMap())
+        return NULL;
+    if ((blockx < 0) || (blocky < 0) || (blockz < 0))
+        return NULL;
+    if ((blockx >= stamped_x) || (blocky >= stamped_y) || (blockz >= stamped_z))
+        return NULL;
+    size_t pos = (size_t(blockz) * stamped_y + blocky) * stamped_x + blockx;
+    const BlockStamp & stamp = stamps[pos];
+    if (!stamp.block || stamp.block != getBlock(blockx, blocky, blockz))
+        return NULL;
+    if (summarized_index != stamped_index || summaries.size() != stamps.size())
+    {
+        summarized_index = stamped_index;
+        summaries.assign(stamps.size(), SummaryEntry());
+    }
+    // generations only go up, so a new map never matches an old summary
+    SummaryEntry & entry = summaries[pos];
+    if (entry.block != stamp.block || entry.summary.generation != stamp.generation)
+    {
+        summarizeBlock(stamp.block, entry.summary);
+        entry.block = stamp.block;
+        entry.summary.generation = stamp.generation;
+    }
+    return &entry.summary;
+}
+
 bool Maps::ReadBlock40d(uint32_t x, uint32_t y, uint32_t z, mapblock40d * buffer)
 {
     df::map_block * block = getBlock(x,y,z);
@@ -172,6 +1515,7 @@ bool Maps::WriteTileTypes (uint32_t x, uint32_t y, uint32_t z, tiletypes40d *buf
     if (block)
     {
         memcpy(block->tiletype, buffer, sizeof(tiletypes40d));
+        markBlockWritten(block);
         return true;
     }
     return false;
@@ -248,6 +1592,7 @@ bool Maps::WriteDesignations (uint32_t x, uint32_t y, uint32_t z, designations40
     if (block)
     {
         memcpy(block->designation, buffer, sizeof(designations40d));
+        markBlockWritten(block);
         return true;
     }
     return false;
@@ -273,6 +1618,7 @@ bool Maps::WriteOccupancy (uint32_t x, uint32_t y, uint32_t z, occupancies40d *b
     if (block)
     {
         memcpy(block->occupancy, buffer, sizeof(occupancies40d));
+        markBlockWritten(block);
         return true;
     }
     return false;
@@ -308,6 +1654,149 @@ bool Maps::WriteTemperatures (uint32_t x, uint32_t y, uint32_t z, t_temperatures
     return false;
 }
 
+/*
+ * Boxes of tiles
+ */
+
+namespace {
+    template<class T>
+    inline void copyRun(T * to, const T * from, int count, uint32_t mask)
+    {
+        memcpy(to, from, count * sizeof(T));
+    }
+
+    // the bitfield ones can leave the bits outside the mask alone
+    template<class T>
+    inline void copyBits(T * to, const T * from, int count, uint32_t mask)
+    {
+        if (mask == 0xFFFFFFFF)
+        {
+            memcpy(to, from, count * sizeof(T));
+            return;
+        }
+        for (int i = 0; i < count; i++)
+            to[i].whole = (to[i].whole & ~mask) | (from[i].whole & mask);
+    }
+    inline void copyRun(df::tile_designation * to, const df::tile_designation * from, int count, uint32_t mask)
+    {
+        copyBits(to, from, count, mask);
+    }
+    inline void copyRun(df::tile_occupancy * to, const df::tile_occupancy * from, int count, uint32_t mask)
+    {
+        copyBits(to, from, count, mask);
+    }
+
+    bool boxOnMap(DFCoord min, DFCoord max)
+    {
+        uint32_t x_max, y_max, z_max;
+        Maps::getSize(x_max, y_max, z_max);
+        return min.x >= 0 && min.y >= 0 && min.z >= 0 &&
+               min.x <= max.x && min.y <= max.y && min.z <= max.z &&
+               max.x < int32_t(x_max * 16) && max.y < int32_t(y_max * 16) && max.z < int32_t(z_max);
+    }
+
+    /*
+     * Copies the box between the buffer and one [16][16] array of the blocks.
+     * Reading from a missing block zeroes its part of the buffer.
+     */
+    template<class T>
+    bool copyBox(DFCoord min, DFCoord max, T * buffer, T (df::map_block::*field)[16][16],
+                 bool write, uint32_t mask = 0xFFFFFFFF, bool designate = false)
+    {
+        if (!boxOnMap(min, max))
+            return false;
+        int size_x = max.x - min.x + 1, size_y = max.y - min.y + 1;
+        bool all = true;
+        for (int z = min.z; z <= max.z; z++)
+        for (int bx = min.x >> 4; bx <= max.x >> 4; bx++)
+        for (int by = min.y >> 4; by <= max.y >> 4; by++)
+        {
+            df::map_block * block = Maps::getBlock(bx, by, z);
+            int x0 = std::max(int(min.x), bx * 16), x1 = std::min(int(max.x), bx * 16 + 15);
+            int y0 = std::max(int(min.y), by * 16), y1 = std::min(int(max.y), by * 16 + 15);
+            int count = y1 - y0 + 1;
+            if (!block)
+                all = false;
+            else if (write)
+            {
+                Maps::markBlockWritten(block);
+                if (designate)
+                    block->flags.bits.designated = true;
+            }
+            for (int x = x0; x <= x1; x++)
+            {
+                T * run = buffer + ((z - min.z) * size_x + (x - min.x)) * size_y + (y0 - min.y);
+                if (!block)
+                {
+                    if (!write)
+                        memset(run, 0, count * sizeof(T));
+                    continue;
+                }
+                T * tiles = &(block->*field)[x & 15][y0 & 15];
+                if (write)
+                    copyRun(tiles, run, count, mask);
+                else
+                    memcpy(run, tiles, count * sizeof(T));
+            }
+        }
+        return all;
+    }
+}
+
+bool Maps::ReadTileTypes(DFCoord min, DFCoord max, df::tiletype *buffer)
+{
+    return copyBox(min, max, buffer, &df::map_block::tiletype, false);
+}
+
+bool Maps::WriteTileTypes(DFCoord min, DFCoord max, const df::tiletype *buffer)
+{
+    return copyBox(min, max, (df::tiletype *) buffer, &df::map_block::tiletype, true);
+}
+
+bool Maps::ReadDesignations(DFCoord min, DFCoord max, df::tile_designation *buffer)
+{
+    return copyBox(min, max, buffer, &df::map_block::designation, false);
+}
+
+bool Maps::WriteDesignations(DFCoord min, DFCoord max, const df::tile_designation *buffer, uint32_t mask)
+{
+    df::tile_designation dig;
+    dig.whole = 0;
+    dig.bits.dig = (df::tile_dig_designation) 7;
+    return copyBox(min, max, (df::tile_designation *) buffer, &df::map_block::designation,
+                   true, mask, (mask & dig.whole) != 0);
+}
+
+bool Maps::ReadOccupancy(DFCoord min, DFCoord max, df::tile_occupancy *buffer)
+{
+    return copyBox(min, max, buffer, &df::map_block::occupancy, false);
+}
+
+bool Maps::WriteOccupancy(DFCoord min, DFCoord max, const df::tile_occupancy *buffer, uint32_t mask)
+{
+    return copyBox(min, max, (df::tile_occupancy *) buffer, &df::map_block::occupancy, true, mask);
+}
+
+bool Maps::ReadTemperatures(DFCoord min, DFCoord max, uint16_t *temp1, uint16_t *temp2)
+{
+    bool ok = boxOnMap(min, max);
+    if (temp1)
+        ok = copyBox(min, max, temp1, &df::map_block::temperature_1, false) && ok;
+    if (temp2)
+        ok = copyBox(min, max, temp2, &df::map_block::temperature_2, false) && ok;
+    return ok;
+}
+
+bool Maps::WriteTemperatures(DFCoord min, DFCoord max, const uint16_t *temp1, const uint16_t *temp2)
+{
+    bool ok = boxOnMap(min, max);
+    if (temp1)
+        ok = copyBox(min, max, (uint16_t *) temp1, &df::map_block::temperature_1, true) && ok;
+    if (temp2)
+        ok = copyBox(min, max, (uint16_t *) temp2, &df::map_block::temperature_2, true) && ok;
+    return ok;
+}
+
 /*
  * Region Offsets - used for layer geology
  */
@@ -322,21 +1811,150 @@ bool Maps::ReadRegionOffsets (uint32_t x, uint32_t y, uint32_t z, biome_indices4
     return false;
 }
 
+/*
+ * Features
+ */
+
+namespace {
+    struct FeatureCache
+    {
+        bool ready;
+        // the game and map the features were read for
+        void * world_data;
+        void * block_index;
+        int32_t region_x, region_y;
+        int32_t x_count_block, y_count_block;
+        // global features by index
+        vector<t_feature> global;
+        // the local features of every region the map touches, one region after another
+        vector<t_feature> local;
+        // where the local features of each block column start in 'local', and how many, x first
+        struct Column
+        {
+            uint32_t first;
+            uint32_t count;
+        };
+        vector<Column> columns;
+
+        FeatureCache() : ready(false), world_data(0), block_index(0) {}
+    };
+    FeatureCache feature_cache;
+
+    void copyFeature(t_feature & feature, df::feature_init * f)
+    {
+        feature.discovered = false;
+        feature.origin = f;
+        feature.type = f->getType();
+        f->getMaterial(&feature.main_material, &feature.sub_material);
+    }
+
+    // the local features of the region a block column is in, 0 if it has none
+    vector<df::feature_init *> * regionFeatures(df::coord2d coord)
+    {
+        // regionX and regionY are in embark squares!
+        // we convert to full region tiles
+        // this also works in adventure mode
+        // region X coord - whole regions
+        uint32_t region_x = ( (coord.x / 3) + world->map.region_x ) / 16;
+        // region Y coord - whole regions
+        uint32_t region_y = ( (coord.y / 3) + world->map.region_y ) / 16;
+
+        uint32_t bigregion_x = region_x / 16;
+        uint32_t bigregion_y = region_y / 16;
+
+        uint32_t sub_x = region_x % 16;
+        uint32_t sub_y = region_y % 16;
+        // megaregions = 16x16 squares of regions = 256x256 squares of embark squares
+
+        // bigregion is 16x16 regions. for each bigregion in X dimension:
+        if (!world->world_data->unk_204[bigregion_x][bigregion_y].features)
+            return 0;
+
+        return &world->world_data->unk_204[bigregion_x][bigregion_y].features->feature_init[sub_x][sub_y];
+    }
+
+    // reads all the features the map can refer to, unless that was already done for it
+    FeatureCache & readyFeatures()
+    {
+        FeatureCache & cache = feature_cache;
+        if (cache.ready &&
+            cache.world_data == (void *) world->world_data &&
+            cache.block_index == (void *) world->map.block_index &&
+            cache.region_x == world->map.region_x &&
+            cache.region_y == world->map.region_y &&
+            cache.x_count_block == world->map.x_count_block &&
+            cache.y_count_block == world->map.y_count_block)
+            return cache;
+
+        cache.ready = true;
+        cache.world_data = world->world_data;
+        cache.block_index = world->map.block_index;
+        cache.region_x = world->map.region_x;
+        cache.region_y = world->map.region_y;
+        cache.x_count_block = world->map.x_count_block;
+        cache.y_count_block = world->map.y_count_block;
+        cache.global.clear();
+        cache.local.clear();
+        cache.columns.clear();
+        if (!world->world_data)
+            return cache;
+
+        vector<df::world_underground_region *> & regions = world->world_data->underground_regions;
+        cache.global.resize(regions.size());
+        for (size_t i = 0; i < regions.size(); i++)
+            copyFeature(cache.global[i], regions[i]->feature_init);
+
+        // a map is only ever in a few regions, they are shared by many columns
+        vector< std::pair<vector<df::feature_init *> *, FeatureCache::Column> > seen;
+        cache.columns.resize(size_t(std::max(cache.x_count_block, 0)) * std::max(cache.y_count_block, 0));
+        for (int32_t y = 0; y < cache.y_count_block; y++)
+        {
+            for (int32_t x = 0; x < cache.x_count_block; x++)
+            {
+                FeatureCache::Column column = { 0, 0 };
+                vector<df::feature_init *> * features = regionFeatures(df::coord2d(x, y));
+                if (features)
+                {
+                    size_t i = 0;
+                    while (i < seen.size() && seen[i].first != features)
+                        i++;
+                    if (i == seen.size())
+                    {
+                        column.first = cache.local.size();
+                        column.count = features->size();
+                        cache.local.resize(column.first + column.count);
+                        for (uint32_t j = 0; j < column.count; j++)
+                            copyFeature(cache.local[column.first + j], (*features)[j]);
+                        seen.push_back(std::make_pair(features, column));
+                    }
+                    column = seen[i].second;
+                }
+                cache.columns[y * cache.x_count_block + x] = column;
+            }
+        }
+        return cache;
+    }
+}
+
+void Maps::ClearFeatureCache()
+{
+    feature_cache.ready = false;
+    feature_cache.global.clear();
+    feature_cache.local.clear();
+    feature_cache.columns.clear();
+}
+
 bool Maps::GetGlobalFeature(t_feature &feature, int32_t index)
 {
     feature.type = (df::feature_type)-1;
     if (!world->world_data)
         return false;
 
-    if ((index < 0) || (index >= world->world_data->underground_regions.size()))
+    FeatureCache & cache = readyFeatures();
+    if ((index < 0) || (index >= cache.global.size()))
         return false;
 
-	df::feature_init *f = world->world_data->underground_regions[index]->feature_init;
-
-    feature.discovered = false;
-    feature.origin = f;
-    feature.type = f->getType();
-    f->getMaterial(&feature.main_material, &feature.sub_material);
+    feature = cache.global[index];
     return true;
 }
 
@@ -346,34 +1964,22 @@ bool Maps::GetLocalFeature(t_feature &feature, df::coord2d coord, int32_t index)
     if (!world->world_data)
         return false;
 
-    // regionX and regionY are in embark squares!
-    // we convert to full region tiles
-    // this also works in adventure mode
-    // region X coord - whole regions
-    uint32_t region_x = ( (coord.x / 3) + world->map.region_x ) / 16;
-    // region Y coord - whole regions
-    uint32_t region_y = ( (coord.y / 3) + world->map.region_y ) / 16;
-
-    uint32_t bigregion_x = region_x / 16;
-    uint32_t bigregion_y = region_y / 16;
-
-    uint32_t sub_x = region_x % 16;
-    uint32_t sub_y = region_y % 16;
-    // megaregions = 16x16 squares of regions = 256x256 squares of embark squares
-
-    // bigregion is 16x16 regions. for each bigregion in X dimension:
-    if (!world->world_data->unk_204[bigregion_x][bigregion_y].features)
-        return false;
+    FeatureCache & cache = readyFeatures();
+    if (coord.x < 0 || coord.y < 0 || coord.x >= cache.x_count_block || coord.y >= cache.y_count_block)
+    {
+        // off the map, look it up the long way
+        vector <df::feature_init *> * features = regionFeatures(coord);
+        if (!features || (index < 0) || (index >= features->size()))
+            return false;
+        copyFeature(feature, (*features)[index]);
+        return true;
+    }
 
-    vector <df::feature_init *> &features = world->world_data->unk_204[bigregion_x][bigregion_y].features->feature_init[sub_x][sub_y];
-    if ((index < 0) || (index >= features.size()))
+    const FeatureCache::Column & column = cache.columns[coord.y * cache.x_count_block + coord.x];
+    if ((index < 0) || (uint32_t(index) >= column.count))
         return false;
-    df::feature_init *f = features[index];
 
-    feature.discovered = false;
-    feature.origin = f;
-    feature.type = f->getType();
-    f->getMaterial(&feature.main_material, &feature.sub_material);
+    feature = cache.local[column.first + index];
     return true;
 }
 
@@ -537,6 +2143,7 @@ bool Maps::RemoveBlockEvent(uint32_t x, uint32_t y, uint32_t z, df::block_square
         {
             delete which;
             block->block_events.erase(block->block_events.begin() + i);
+            markBlockWritten(block);
             return true;
         }
     }
@@ -28,6 +28,7 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <cstring>
 using namespace std;
 
@@ -40,6 +41,7 @@ using namespace std;
 #include "Core.h"
 
 #include "MiscUtils.h"
+#include "tinythread.h"
 
 #include "df/world.h"
 #include "df/ui.h"
@@ -160,7 +162,111 @@ bool MaterialInfo::decode(int16_t type, int32_t index)
     return (material != NULL);
 }
 
+/*
+ * Token index
+ */
+
+namespace {
+    typedef std::pair<int32_t, int32_t> MatKey;
+
+    // the raws ids and material tokens, looked up both ways, built when first
+    // needed after the raws are loaded
+    struct TokenIndex
+    {
+        // the raws the index was built for, telling one load from the next
+        size_t inorganic_count, plant_count, creature_count;
+        void * inorganic_first, * plant_first, * creature_first;
+
+        std::map<std::string, int16_t> builtins;
+        std::map<std::string, int32_t> inorganics;
+        std::map<std::string, int32_t> plants;
+        std::map<std::string, int32_t> creatures;
+
+        // whole tokens that were looked for before, and what they were
+        std::map<std::string, MatKey> found;
+        std::set<std::string> missed;
+        // the other way round, getToken and toString by (type, index). the
+        // strings are handed out by reference, so entries are never changed
+        std::map<MatKey, std::string> tokens;
+        std::map<std::pair<MatKey, int>, std::string> names;
+
+        TokenIndex()
+            : inorganic_count(0), plant_count(0), creature_count(0),
+              inorganic_first(0), plant_first(0), creature_first(0) {}
+    };
+    TokenIndex token_index;
+    // taken by everything that uses the index. find() takes it again
+    // through the find* functions
+    tthread::recursive_mutex token_lock;
+
+    template<class T> void * firstOf(std::vector<T*> &vec)
+    {
+        return vec.empty() ? NULL : (void*)vec[0];
+    }
+
+    TokenIndex &tokenIndex()
+    {
+        df::world_raws &raws = world->raws;
+        TokenIndex &idx = token_index;
+        if (idx.inorganic_count == raws.inorganics.size() &&
+            idx.plant_count == raws.plants.all.size() &&
+            idx.creature_count == raws.creatures.all.size() &&
+            idx.inorganic_first == firstOf(raws.inorganics) &&
+            idx.plant_first == firstOf(raws.plants.all) &&
+            idx.creature_first == firstOf(raws.creatures.all) &&
+            !idx.builtins.empty())
+            return idx;
+
+        idx = TokenIndex();
+        idx.inorganic_count = raws.inorganics.size();
+        idx.plant_count = raws.plants.all.size();
+        idx.creature_count = raws.creatures.all.size();
+        idx.inorganic_first = firstOf(raws.inorganics);
+        idx.plant_first = firstOf(raws.plants.all);
+        idx.creature_first = firstOf(raws.creatures.all);
+
+        // insert() keeps the first of any duplicate ids, like the old scans did
+        for (int i = 1; i < MaterialInfo::NUM_BUILTIN; i++)
+            if (raws.mat_table.builtin[i])
+                idx.builtins.insert(std::make_pair(raws.mat_table.builtin[i]->id, int16_t(i)));
+        for (size_t i = 0; i < raws.inorganics.size(); i++)
+            idx.inorganics.insert(std::make_pair(raws.inorganics[i]->id, int32_t(i)));
+        for (size_t i = 0; i < raws.plants.all.size(); i++)
+            idx.plants.insert(std::make_pair(raws.plants.all[i]->id, int32_t(i)));
+        for (size_t i = 0; i < raws.creatures.all.size(); i++)
+            idx.creatures.insert(std::make_pair(raws.creatures.all[i]->creature_id, int32_t(i)));
+        return idx;
+    }
+
+    int32_t lookup(const std::map<std::string, int32_t> &ids, const std::string &token)
+    {
+        std::map<std::string, int32_t>::const_iterator it = ids.find(token);
+        return it == ids.end() ? -1 : it->second;
+    }
+}
+
 bool MaterialInfo::find(const std::string &token)
+{
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
+    TokenIndex &idx = tokenIndex();
+    std::map<std::string, MatKey>::iterator it = idx.found.find(token);
+    if (it != idx.found.end())
+    {
+        decode(it->second.first, it->second.second);
+        return true;
+    }
+    if (idx.missed.count(token))
+        return decode(-1);
+    if (!findToken(token))
+    {
+        idx.missed.insert(token);
+        return decode(-1);
+    }
+    idx.found[token] = MatKey(type, index);
+    return true;
+}
+
+bool MaterialInfo::findToken(const std::string &token)
 {
     std::vector<std::string> items;
     split_string(&items, token, ":");
@@ -194,6 +300,7 @@ bool MaterialInfo::find(const std::string &token)
 
 bool MaterialInfo::findBuiltin(const std::string &token)
 {
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
     if (token.empty())
         return decode(-1);
 
@@ -202,15 +309,16 @@ bool MaterialInfo::findBuiltin(const std::string &token)
         return true;
     }
 
-    df::world_raws &raws = world->raws;
-    for (int i = 1; i < NUM_BUILTIN; i++)
-        if (raws.mat_table.builtin[i]->id == token)
-            return decode(i, -1);
+    TokenIndex &idx = tokenIndex();
+    std::map<std::string, int16_t>::const_iterator it = idx.builtins.find(token);
+    if (it != idx.builtins.end())
+        return decode(it->second, -1);
     return decode(-1);
 }
 
 bool MaterialInfo::findInorganic(const std::string &token)
 {
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
     if (token.empty())
         return decode(-1);
 
@@ -219,26 +327,21 @@ bool MaterialInfo::findInorganic(const std::string &token)
         return true;
     }
 
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.inorganics.size(); i++)
-    {
-        df::inorganic_raw *p = raws.inorganics[i];
-        if (p->id == token)
-            return decode(0, i);
-    }
+    int32_t i = lookup(tokenIndex().inorganics, token);
+    if (i >= 0)
+        return decode(0, i);
     return decode(-1);
 }
 
 bool MaterialInfo::findPlant(const std::string &token, const std::string &subtoken)
 {
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
     if (token.empty())
         return decode(-1);
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.plants.all.size(); i++)
+    int32_t i = lookup(tokenIndex().plants, token);
+    if (i >= 0)
     {
-        df::plant_raw *p = raws.plants.all[i];
-        if (p->id != token)
-            continue;
+        df::plant_raw *p = world->raws.plants.all[i];
 
         // As a special exception, return the structural material with empty subtoken
         if (subtoken.empty())
@@ -247,74 +350,87 @@ bool MaterialInfo::findPlant(const std::string &token, const std::string &subtok
         for (size_t j = 0; j < p->material.size(); j++)
             if (p->material[j]->id == subtoken)
                 return decode(PLANT_BASE+j, i);
-
-        break;
     }
     return decode(-1);
 }
 
 bool MaterialInfo::findCreature(const std::string &token, const std::string &subtoken)
 {
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
     if (token.empty() || subtoken.empty())
         return decode(-1);
-    df::world_raws &raws = world->raws;
-    for (size_t i = 0; i < raws.creatures.all.size(); i++)
+    int32_t i = lookup(tokenIndex().creatures, token);
+    if (i >= 0)
     {
-        df::creature_raw *p = raws.creatures.all[i];
-        if (p->creature_id != token)
-            continue;
+        df::creature_raw *p = world->raws.creatures.all[i];
 
         for (size_t j = 0; j < p->material.size(); j++)
             if (p->material[j]->id == subtoken)
                 return decode(CREATURE_BASE+j, i);
-
-        break;
     }
     return decode(-1);
 }
 
-std::string MaterialInfo::getToken()
+const std::string &MaterialInfo::getToken()
 {
-    if (isNone())
-        return "NONE";
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
+    std::string &token = tokenIndex().tokens[MatKey(type, index)];
+    if (!token.empty())
+        return token;
 
-    if (!material)
-        return stl_sprintf("INVALID:%d:%d", type, index);
-
-    switch (mode) {
+    if (isNone())
+        token = "NONE";
+    else if (!material)
+        token = stl_sprintf("INVALID:%d:%d", type, index);
+    else switch (mode) {
     case Builtin:
-        return material->id;
+        token = material->id;
+        break;
     case Inorganic:
-        return "INORGANIC:" + inorganic->id;
+        token = "INORGANIC:" + inorganic->id;
+        break;
     case Creature:
-        return "CREATURE:" + creature->creature_id + ":" + material->id;
+        token = "CREATURE:" + creature->creature_id + ":" + material->id;
+        break;
     case Plant:
-        return "PLANT:" + plant->id + ":" + material->id;
+        token = "PLANT:" + plant->id + ":" + material->id;
+        break;
     default:
-        return stl_sprintf("INVALID_MODE:%d:%d", type, index);
+        token = stl_sprintf("INVALID_MODE:%d:%d", type, index);
     }
+    return token;
 }
 
-std::string MaterialInfo::toString(uint16_t temp, bool named)
+const std::string &MaterialInfo::toString(uint16_t temp, bool named)
 {
-    if (isNone())
-        return "any";
-
-    if (!material)
-        return stl_sprintf("INVALID:%d:%d", type, index);
-
-    df::matter_state state = matter_state::Solid;
-    if (temp >= material->heat.melting_point)
-        state = matter_state::Liquid;
-    if (temp >= material->heat.boiling_point)
-        state = matter_state::Gas;
+    tthread::lock_guard<tthread::recursive_mutex> guard(token_lock);
+    int state = -1;
+    if (material)
+    {
+        state = matter_state::Solid;
+        if (temp >= material->heat.melting_point)
+            state = matter_state::Liquid;
+        if (temp >= material->heat.boiling_point)
+            state = matter_state::Gas;
+    }
+    bool of_figure = named && figure && material;
 
-    std::string name = material->state_name[state];
-    if (!material->prefix.empty())
-        name = material->prefix + " " + name;
+    std::string &name = tokenIndex().names[std::make_pair(MatKey(type, index), state * 2 + of_figure)];
+    if (!name.empty())
+        return name;
 
-    if (named && figure)
-        name += stl_sprintf(" of HF %d", index);
+    if (isNone())
+        name = "any";
+    else if (!material)
+        name = stl_sprintf("INVALID:%d:%d", type, index);
+    else
+    {
+        name = material->state_name[state];
+        if (!material->prefix.empty())
+            name = material->prefix + " " + name;
+        if (of_figure)
+            name += stl_sprintf(" of HF %d", index);
+    }
     return name;
 }
 
@@ -123,6 +123,7 @@ static command_result autodump_main(Core * c, vector <string> & parameters)
     MapCache MC;
     int i = 0;
     int dumped_total = 0;
+    int unreachable = 0;
 
     int cx, cy, cz;
     DFCoord pos_cursor;
@@ -151,6 +152,8 @@ static command_result autodump_main(Core * c, vector <string> & parameters)
                 return CR_FAILURE;
             }
         }
+        // to tell if the dwarves could have carried the items there
+        Maps::updateRegions();
     }
     coordmap counts;
     // proceed with the dumpification operation
@@ -202,6 +205,10 @@ static command_result autodump_main(Core * c, vector <string> & parameters)
             if (pos_cursor == pos_item)
                 continue;
 
+            if (Maps::getRegion(pos_item.x, pos_item.y, pos_item.z) &&
+                !Maps::isConnected(pos_item, pos_cursor))
+                unreachable++;
+
             // Do we need to fix block-local item ID vector?
             if(pos_item/16 != pos_cursor/16)
             {
@@ -280,6 +287,8 @@ static command_result autodump_main(Core * c, vector <string> & parameters)
         Maps::WriteDirtyBit(cx/16, cy/16, cz, true);
     }
     c->con.print("Done. %d items %s.\n", dumped_total, destroy ? "marked for destruction" : "quickdumped");
+    if (unreachable)
+        c->con.print("%d of them came from places that can't be walked to from the cursor.\n", unreachable);
     return CR_OK;
 }
 
@@ -0,0 +1,130 @@
+// Shows which map blocks changed since the last time it was run.
+
+#include "Core.h"
+#include "Console.h"
+#include "Export.h"
+#include "PluginManager.h"
+#include "MiscUtils.h"
+#include <vector>
+#include <string>
+
+#include "DirtyPages.h"
+#include "modules/Maps.h"
+
+using std::vector;
+using std::string;
+using namespace DFHack;
+using namespace DFHack::Simple;
+
+command_result blockchanges (Core * c, vector <string> & parameters);
+
+// what the last run saw
+static uint32_t last_generation = 0;
+static uint32_t last_frame = 0;
+static bool watching = false;
+
+DFhackCExport const char * plugin_name ( void )
+{
+    return "blockchanges";
+}
+
+DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand> &commands)
+{
+    commands.clear();
+    commands.push_back(PluginCommand(
+        "blockchanges", "List the map blocks changed since the last run.",
+        blockchanges, false,
+        "  blockchanges [all|list|watch|unwatch]\n"
+        "    Counts the blocks that changed since the last run, and how long\n"
+        "    finding them took. 'all' starts over and counts every block,\n"
+        "    'list' prints the position of each changed block.\n"
+        "    'watch' turns on tracking of the memory pages DF writes to, after\n"
+        "    that only the blocks on written pages are checked, and the units\n"
+        "    and items on them are counted too. 'unwatch' turns it off.\n"
+    ));
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_shutdown ( Core * c )
+{
+    if (watching)
+    {
+        CoreSuspender suspend(c);
+        c->getDirtyPages()->disable();
+        watching = false;
+    }
+    return CR_OK;
+}
+
+command_result blockchanges (Core * c, vector <string> & parameters)
+{
+    bool list = false;
+    int watch = 0;
+    for (size_t i = 0; i < parameters.size(); i++)
+    {
+        if (parameters[i] == "all")
+            last_generation = 0;
+        else if (parameters[i] == "list")
+            list = true;
+        else if (parameters[i] == "watch")
+            watch = 1;
+        else if (parameters[i] == "unwatch")
+            watch = -1;
+        else
+            return CR_WRONG_USAGE;
+    }
+
+    CoreSuspender suspend(c);
+    if (!Maps::IsValid())
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+
+    DirtyPages * dirty = c->getDirtyPages();
+    if (watch > 0 && !watching)
+    {
+        if (!dirty->enable())
+        {
+            c->con.printerr("This system can't track memory writes.\n");
+            return CR_FAILURE;
+        }
+        watching = true;
+        last_frame = dirty->getFrame();
+    }
+    if (watch < 0 && watching)
+    {
+        dirty->disable();
+        watching = false;
+    }
+
+    vector<df::map_block *> changed;
+    uint64_t start = GetTimeUs64();
+    uint32_t generation = Maps::getChangedBlocks(last_generation, changed);
+    uint64_t elapsed = GetTimeUs64() - start;
+
+    if (list)
+    {
+        for (size_t i = 0; i < changed.size(); i++)
+        {
+            df::coord pos = changed[i]->map_pos;
+            c->con.print("%d/%d/%d\n", pos.x / 16, pos.y / 16, pos.z);
+        }
+    }
+    c->con.print("%d blocks changed between generation %u and %u, found in %.3f ms.\n",
+                 (int) changed.size(), last_generation, generation, elapsed / 1000.0);
+    last_generation = generation;
+
+    if (watching)
+    {
+        vector<df::unit *> units;
+        vector<df::item *> items;
+        if (dirty->getChangedUnits(last_frame, units) && dirty->getChangedItems(last_frame, items))
+            c->con.print("%d units and %d items were written to in %u frames.\n",
+                         (int) units.size(), (int) items.size(), dirty->getFrame() - last_frame);
+        else
+            c->con.print("Lost track of the units and items, counting from now.\n");
+        last_frame = dirty->getFrame();
+    }
+    return CR_OK;
+}
@@ -0,0 +1,171 @@
+// Measures how fast MapCache can look at every tile of the map.
+
+#include "Core.h"
+#include "Console.h"
+#include "Export.h"
+#include "PluginManager.h"
+#include "MiscUtils.h"
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+
+#include "modules/Maps.h"
+#include "modules/MapCache.h"
+#include "TileTypes.h"
+
+using std::vector;
+using std::string;
+using namespace DFHack;
+using namespace DFHack::Simple;
+
+command_result mapbench (Core * c, vector <string> & parameters);
+
+DFhackCExport const char * plugin_name ( void )
+{
+    return "mapbench";
+}
+
+DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand> &commands)
+{
+    commands.clear();
+    commands.push_back(PluginCommand(
+        "mapbench", "Measure MapCache tile access speed.",
+        mapbench, false,
+        "  mapbench [passes]\n"
+        "    Reads the tile type of every tile on the map through a fresh\n"
+        "    MapCache 'passes' times (default 5) and prints the time per tile.\n"
+        "    The first pass includes reading the blocks. The passes go along x\n"
+        "    first, then once more along z first, which jumps between blocks,\n"
+        "    and once more copying a whole level at a time with Maps::ReadTileTypes.\n"
+        "    The repaint pass looks up what every tile would become when painted\n"
+        "    with its own shape and material, and as a floor, without writing it.\n"
+        "    Then it sums up all blocks with Maps::forEachBlock using 1, 2, 4\n"
+        "    and 8 threads, and once with the default of one per core.\n"
+    ));
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_shutdown ( Core * c )
+{
+    return CR_OK;
+}
+
+// the same work as one tile pass, but straight from the DF blocks
+struct TileSum : public Maps::BlockVisitor
+{
+    uint32_t sum;
+
+    TileSum() : sum(0) {}
+
+    Maps::BlockVisitor * fork()
+    {
+        return new TileSum();
+    }
+    void visit(df::map_block * block)
+    {
+        for (int x = 0; x < 16; x++)
+            for (int y = 0; y < 16; y++)
+                sum += block->tiletype[x][y];
+    }
+    void merge(Maps::BlockVisitor * part)
+    {
+        sum += ((TileSum *) part)->sum;
+    }
+};
+
+static void printPass(Core * c, const char * what, uint64_t elapsed, uint64_t tiles, uint32_t sum)
+{
+    c->con.print("%-12s %10.3f ms %8.2f ns/tile  (%u)\n", what,
+                 elapsed / 1000.0, tiles ? elapsed * 1000.0 / tiles : 0.0, sum);
+}
+
+command_result mapbench (Core * c, vector <string> & parameters)
+{
+    int passes = 5;
+    if (parameters.size() > 1)
+        return CR_WRONG_USAGE;
+    if (parameters.size() == 1)
+    {
+        passes = atoi(parameters[0].c_str());
+        if (passes < 1)
+            return CR_WRONG_USAGE;
+    }
+
+    CoreSuspender suspend(c);
+    if (!Maps::IsValid())
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    uint32_t x_max, y_max, z_max;
+    Maps::getSize(x_max, y_max, z_max);
+    uint32_t tx_max = x_max * 16, ty_max = y_max * 16;
+    uint64_t tiles = uint64_t(tx_max) * ty_max * z_max;
+    c->con.print("%u x %u x %u tiles.\n", tx_max, ty_max, z_max);
+
+    // not the shared cache, the first pass has to read everything
+    MapExtras::MapCache mc;
+    // summed up and printed so the reads can't be optimized away
+    uint32_t sum = 0;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        uint64_t start = GetTimeUs64();
+        for (uint32_t z = 0; z < z_max; z++)
+            for (uint32_t y = 0; y < ty_max; y++)
+                for (uint32_t x = 0; x < tx_max; x++)
+                    sum += mc.tiletypeAt(DFCoord(x, y, z));
+        printPass(c, pass ? "x first" : "x first cold", GetTimeUs64() - start, tiles, sum);
+    }
+    uint64_t start = GetTimeUs64();
+    for (uint32_t y = 0; y < ty_max; y++)
+        for (uint32_t x = 0; x < tx_max; x++)
+            for (uint32_t z = 0; z < z_max; z++)
+                sum += mc.tiletypeAt(DFCoord(x, y, z));
+    printPass(c, "z first", GetTimeUs64() - start, tiles, sum);
+
+    // a level at a time, copied out of the blocks in runs
+    vector<df::tiletype> level(tx_max * ty_max);
+    start = GetTimeUs64();
+    for (uint32_t z = 0; z < z_max; z++)
+    {
+        Maps::ReadTileTypes(DFCoord(0, 0, z), DFCoord(tx_max - 1, ty_max - 1, z), &level[0]);
+        for (size_t i = 0; i < level.size(); i++)
+            sum += level[i];
+    }
+    printPass(c, "box read", GetTimeUs64() - start, tiles, sum);
+
+    // the lookups tiletypes, liquids, deramp and fixveins do for each tile they paint
+    start = GetTimeUs64();
+    for (uint32_t z = 0; z < z_max; z++)
+    {
+        Maps::ReadTileTypes(DFCoord(0, 0, z), DFCoord(tx_max - 1, ty_max - 1, z), &level[0]);
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            df::tiletype tt = level[i];
+            sum += findTileType(tileShape(tt), tileMaterial(tt), tileVariant(tt), tileSpecial(tt), tileDirection(tt));
+            sum += findSimilarTileType(tt, tiletype_shape::FLOOR);
+        }
+    }
+    printPass(c, "repaint", GetTimeUs64() - start, tiles, sum);
+
+    const int thread_counts[] = { 1, 2, 4, 8, 0 };
+    uint64_t single = 0;
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(int); i++)
+    {
+        TileSum scan;
+        start = GetTimeUs64();
+        Maps::forEachBlock(scan, thread_counts[i]);
+        uint64_t elapsed = GetTimeUs64() - start;
+        if (!single)
+            single = elapsed ? elapsed : 1;
+        char what[32];
+        if (thread_counts[i])
+            sprintf(what, "%d threads", thread_counts[i]);
+        else
+            sprintf(what, "all cores");
+        printPass(c, what, elapsed, tiles, scan.sum);
+        c->con.print("%-12s %10.2fx faster than one thread\n", "", double(single) / (elapsed ? elapsed : 1));
+    }
+    return CR_OK;
+}
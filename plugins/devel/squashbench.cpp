@@ -0,0 +1,257 @@
+// Measures how fast MapCache works out the vein and layer materials of a block.
+
+#include "Core.h"
+#include "Console.h"
+#include "Export.h"
+#include "PluginManager.h"
+#include "MiscUtils.h"
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include "modules/Maps.h"
+#include "modules/MapCache.h"
+#include "TileTypes.h"
+
+#include "DataDefs.h"
+#include "df/world.h"
+#include "df/map_block.h"
+
+using std::vector;
+using std::string;
+using namespace DFHack;
+using namespace DFHack::Simple;
+using df::global::world;
+
+command_result squashbench (Core * c, vector <string> & parameters);
+
+DFhackCExport const char * plugin_name ( void )
+{
+    return "squashbench";
+}
+
+DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand> &commands)
+{
+    commands.clear();
+    commands.push_back(PluginCommand(
+        "squashbench", "Measure how fast block materials are worked out.",
+        squashbench, false,
+        "  squashbench [veins] [passes]\n"
+        "    Makes 1024 blocks of mostly mineral walls, each covered by 'veins'\n"
+        "    vein events (default 16) taken at random from the map, and works out\n"
+        "    their vein materials 'passes' times (default 10), once with\n"
+        "    SquashVeins and once testing every vein bit by bit, like it used to.\n"
+        "    Then the same for the layer materials of random biomes and layers.\n"
+        "    Nothing on the map is changed.\n"
+    ));
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_shutdown ( Core * c )
+{
+    return CR_OK;
+}
+
+typedef vector<df::block_square_event_mineralst *> VeinList;
+
+// what SquashVeins did before, to compare against
+static void squashBitwise(const VeinList & veins, mapblock40d & mb, t_blockmaterials & materials)
+{
+    memset(materials, -1, sizeof(materials));
+    for (uint32_t j = 0; j < 16; j++)
+    {
+        for (uint32_t k = 0; k < 16; k++)
+        {
+            if (tileMaterial(mb.tiletypes[k][j]) != tiletype_material::MINERAL)
+                continue;
+            for (int i = (int) veins.size() - 1; i >= 0; i--)
+            {
+                if (veins[i]->tile_bitmask[j] & (1 << k))
+                {
+                    materials[k][j] = veins[i]->inorganic_mat;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// what SquashRocks did before, with the layer checked too
+static void rocksNested(vector< vector<uint16_t> > & layerassign, mapblock40d & mb, t_blockmaterials & materials)
+{
+    for (uint32_t x = 0; x < 16; x++)
+    {
+        for (uint32_t y = 0; y < 16; y++)
+        {
+            materials[x][y] = -1;
+            uint8_t biome = mb.designation[x][y].bits.biome;
+            if (biome >= sizeof(mb.biome_indices) || mb.biome_indices[biome] >= layerassign.size())
+                continue;
+            vector<uint16_t> & layers = layerassign.at(mb.biome_indices[biome]);
+            uint32_t layer = mb.designation[x][y].bits.geolayer_index;
+            if (layer < layers.size())
+                materials[x][y] = layers[layer];
+        }
+    }
+}
+
+static uint32_t sumMaterials(t_blockmaterials & materials)
+{
+    uint32_t sum = 0;
+    for (int x = 0; x < 16; x++)
+        for (int y = 0; y < 16; y++)
+            sum += materials[x][y];
+    return sum;
+}
+
+static void printPass(Core * c, const char * what, uint64_t elapsed, uint64_t blocks, uint32_t sum)
+{
+    c->con.print("%-12s %10.3f ms %8.2f us/block  (%u)\n", what,
+                 elapsed / 1000.0, blocks ? elapsed / double(blocks) : 0.0, sum);
+}
+
+command_result squashbench (Core * c, vector <string> & parameters)
+{
+    int vein_count = 16;
+    int passes = 10;
+    if (parameters.size() > 2)
+        return CR_WRONG_USAGE;
+    if (parameters.size() > 0)
+        vein_count = atoi(parameters[0].c_str());
+    if (parameters.size() > 1)
+        passes = atoi(parameters[1].c_str());
+    if (vein_count < 1 || passes < 1)
+        return CR_WRONG_USAGE;
+
+    CoreSuspender suspend(c);
+    if (!Maps::IsValid())
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+
+    // real vein events to cover the blocks with, only ever read
+    VeinList pool;
+    vector<df::map_block *> & map_blocks = world->map.map_blocks;
+    for (size_t i = 0; i < map_blocks.size(); i++)
+    {
+        vector<df::block_square_event *> & events = map_blocks[i]->block_events;
+        for (size_t j = 0; j < events.size(); j++)
+        {
+            if (events[j]->getType() == block_square_event_type::mineral)
+                pool.push_back((df::block_square_event_mineralst *) events[j]);
+        }
+    }
+    if (pool.empty())
+    {
+        c->con.printerr("There are no veins on this map.\n");
+        return CR_FAILURE;
+    }
+    vector< vector<uint16_t> > layerassign;
+    if (!Maps::ReadGeology(layerassign) || layerassign.empty())
+    {
+        c->con.printerr("Can't read the geology.\n");
+        return CR_FAILURE;
+    }
+    MapExtras::GeologyTable geology;
+    geology.assign(layerassign);
+
+    df::tiletype mineral = findTileType(tiletype_shape::WALL, tiletype_material::MINERAL,
+                                        tiletype_variant::NONE, tiletype_special::NONE, TileDirection());
+    df::tiletype stone = findTileType(tiletype_shape::WALL, tiletype_material::STONE,
+                                      tiletype_variant::NONE, tiletype_special::NONE, TileDirection());
+
+    const size_t block_count = 1024;
+    srand(0);
+    vector<mapblock40d> blocks(block_count);
+    vector<VeinList> veins(block_count);
+    for (size_t i = 0; i < block_count; i++)
+    {
+        mapblock40d & mb = blocks[i];
+        memset(&mb, 0, sizeof(mb));
+        for (int x = 0; x < 16; x++)
+        {
+            for (int y = 0; y < 16; y++)
+            {
+                mb.tiletypes[x][y] = (rand() % 4) ? mineral : stone;
+                mb.designation[x][y].bits.biome = rand() % 9;
+                mb.designation[x][y].bits.geolayer_index = rand() % 16;
+            }
+        }
+        for (size_t j = 0; j < sizeof(mb.biome_indices); j++)
+            mb.biome_indices[j] = rand() % layerassign.size();
+        for (int j = 0; j < vein_count; j++)
+            veins[i].push_back(pool[rand() % pool.size()]);
+    }
+    c->con.print("%d blocks with %d veins each, from %d on the map.\n",
+                 int(block_count), vein_count, int(pool.size()));
+
+    uint64_t runs = uint64_t(block_count) * passes;
+    t_blockmaterials fast, slow;
+    size_t wrong = 0;
+    uint32_t sum = 0;
+    uint64_t start = GetTimeUs64();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < block_count; i++)
+        {
+            MapExtras::SquashVeins(veins[i], blocks[i], fast);
+            sum += sumMaterials(fast);
+        }
+    }
+    printPass(c, "veins", GetTimeUs64() - start, runs, sum);
+    sum = 0;
+    start = GetTimeUs64();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < block_count; i++)
+        {
+            squashBitwise(veins[i], blocks[i], slow);
+            sum += sumMaterials(slow);
+        }
+    }
+    printPass(c, "veins, bits", GetTimeUs64() - start, runs, sum);
+    for (size_t i = 0; i < block_count; i++)
+    {
+        MapExtras::SquashVeins(veins[i], blocks[i], fast);
+        squashBitwise(veins[i], blocks[i], slow);
+        wrong += memcmp(fast, slow, sizeof(fast)) != 0;
+    }
+
+    sum = 0;
+    start = GetTimeUs64();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < block_count; i++)
+        {
+            MapExtras::SquashRocks(geology, blocks[i], fast);
+            sum += sumMaterials(fast);
+        }
+    }
+    printPass(c, "rocks", GetTimeUs64() - start, runs, sum);
+    sum = 0;
+    start = GetTimeUs64();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (size_t i = 0; i < block_count; i++)
+        {
+            rocksNested(layerassign, blocks[i], slow);
+            sum += sumMaterials(slow);
+        }
+    }
+    printPass(c, "rocks, nested", GetTimeUs64() - start, runs, sum);
+    for (size_t i = 0; i < block_count; i++)
+    {
+        MapExtras::SquashRocks(geology, blocks[i], fast);
+        rocksNested(layerassign, blocks[i], slow);
+        wrong += memcmp(fast, slow, sizeof(fast)) != 0;
+    }
+
+    if (wrong)
+    {
+        c->con.printerr("%d blocks came out different!\n", int(wrong));
+        return CR_FAILURE;
+    }
+    return CR_OK;
+}
@@ -0,0 +1,125 @@
+// Measures how many suspend/resume requests per second and per frame the core
+// can serve, with several tools competing for the world at once. Tools get the
+// world one at a time, so the rate is bound by the handoffs, not the queue:
+// the slot pool and FIFO order didn't raise it, they only keep Suspend from
+// allocating and serve the tools in the order they asked.
+
+#include "Core.h"
+#include "Console.h"
+#include "Export.h"
+#include "PluginManager.h"
+#include "MiscUtils.h"
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include "tinythread.h"
+
+#include "DataDefs.h"
+#include "df/world.h"
+
+using std::vector;
+using std::string;
+using namespace DFHack;
+using df::global::world;
+
+command_result suspendbench (Core * c, vector <string> & parameters);
+
+// frames seen while the benchmark runs
+static volatile uint32_t frames = 0;
+
+DFhackCExport const char * plugin_name ( void )
+{
+    return "suspendbench";
+}
+
+DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand> &commands)
+{
+    commands.clear();
+    commands.push_back(PluginCommand(
+        "suspendbench", "Measure suspend/resume request throughput.",
+        suspendbench, false,
+        "  suspendbench [threads] [requests]\n"
+        "    Starts 'threads' threads (default 8) that each suspend and resume\n"
+        "    the game 'requests' times (default 100), then prints the achieved\n"
+        "    throughput.\n"
+    ));
+    c->getPluginManager()->setUpdateSchedule("suspendbench", US_NEVER);
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_shutdown ( Core * c )
+{
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_onupdate ( Core * c )
+{
+    frames++;
+    return CR_OK;
+}
+
+struct BenchThread
+{
+    Core * core;
+    int requests;
+    uint32_t sum;
+};
+
+static void benchThread(void * data)
+{
+    BenchThread * bt = (BenchThread *) data;
+    for (int i = 0; i < bt->requests; i++)
+    {
+        CoreSuspender suspend(bt->core);
+        // touch something, like a real tool would
+        bt->sum += world->frame_counter;
+    }
+}
+
+command_result suspendbench (Core * c, vector <string> & parameters)
+{
+    int nthreads = 8;
+    int requests = 100;
+    int numbers = 0;
+    for (size_t i = 0; i < parameters.size(); i++)
+    {
+        if (numbers == 0 && atoi(parameters[i].c_str()) > 0)
+            nthreads = atoi(parameters[i].c_str()), numbers++;
+        else if (numbers == 1 && atoi(parameters[i].c_str()) > 0)
+            requests = atoi(parameters[i].c_str()), numbers++;
+        else
+            return CR_WRONG_USAGE;
+    }
+
+    vector <BenchThread> data(nthreads);
+    vector <tthread::thread *> threads;
+
+    c->getPluginManager()->setUpdateSchedule("suspendbench", US_EVERY_FRAME);
+    frames = 0;
+    uint64_t start = GetTimeUs64();
+    for (int i = 0; i < nthreads; i++)
+    {
+        data[i].core = c;
+        data[i].requests = requests;
+        data[i].sum = 0;
+        threads.push_back(new tthread::thread(benchThread, &data[i]));
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+    uint64_t elapsed = GetTimeUs64() - start;
+    uint32_t used_frames = frames;
+    c->getPluginManager()->setUpdateSchedule("suspendbench", US_NEVER);
+
+    uint64_t total = uint64_t(nthreads) * requests;
+    c->con.print("%llu requests from %d threads in %.3f ms over %u frames.\n",
+                 (unsigned long long)total, nthreads,
+                 elapsed / 1000.0, used_frames);
+    c->con.print("%.0f requests/s, %.2f requests/frame, %.1f us/request.\n",
+                 elapsed ? total * 1000000.0 / elapsed : 0.0,
+                 used_frames ? double(total) / used_frames : double(total),
+                 double(elapsed) / total);
+    return CR_OK;
+}
@@ -54,6 +54,8 @@ static command_result fastdwarf (Core * c, vector <string> & parameters)
             enable_fastdwarf = 0;
         else
             enable_fastdwarf = 1;
+        // job counters only run down while the game isn't paused
+        c->getPluginManager()->setUpdateSchedule("fastdwarf", enable_fastdwarf ? US_TICKS : US_NEVER);
         c->con.print("fastdwarf %sactivated.\n", (enable_fastdwarf ? "" : "de"));
     }
     else
@@ -73,6 +75,7 @@ DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand>
     commands.push_back(PluginCommand("fastdwarf",
         "enable/disable fastdwarf (parameter=0/1)",
         fastdwarf));
+    c->getPluginManager()->setUpdateSchedule("fastdwarf", enable_fastdwarf ? US_TICKS : US_NEVER);
 
     return CR_OK;
 }
@@ -11,9 +11,11 @@
 #include "PluginManager.h"
 #include "modules/Maps.h"
 #include "modules/MapCache.h"
+#include "modules/FloodFill.h"
 #include "modules/Gui.h"
-using std::stack;
 using MapExtras::MapCache;
+using MapExtras::FloodFill;
+using MapExtras::FloodPolicy;
 using namespace DFHack;
 using namespace df::enums;
 
@@ -78,12 +80,60 @@ DFhackCExport command_result plugin_shutdown ( Core * c )
     return CR_OK;
 }
 
+//Sets the traffic of the connected tiles with the source designation.
+class TrafficFlood : public FloodPolicy
+{
+public:
+    TrafficFlood(MapCache & MCache, df::tile_traffic source, df::tile_traffic target,
+                 bool updown, bool checkpit, bool checkbuilding)
+        : MCache(MCache), source(source), target(target), updown(updown),
+          checkpit(checkpit), checkbuilding(checkbuilding) {}
+
+    int enter(DFCoord xy, Direction from)
+    {
+        if (!MCache.testCoord(xy)) return STOP;
+
+        df::tile_designation des = MCache.designationAt(xy);
+        if (des.bits.traffic != source) return STOP;
+
+        df::tiletype tt = MCache.tiletypeAt(xy);
+
+        if(isWallTerrain(tt)) return STOP;
+        if(checkpit && isOpenTerrain(tt)) return STOP;
+
+        if (checkbuilding)
+        {
+            df::tile_occupancy oc = MCache.occupancyAt(xy);
+            if(oc.bits.building) return STOP;
+        }
+
+        int act = SPREAD;
+        if (updown)
+        {
+            if (LowPassable(tt)) act |= DOWN;
+            if (HighPassable(tt)) act |= UP;
+        }
+        return act;
+    }
+
+    //This tile is ready.  Set its traffic level.
+    void visit(DFCoord xy, Direction from)
+    {
+        df::tile_designation des = MCache.designationAt(xy);
+        des.bits.traffic = target;
+        MCache.setDesignationAt(xy,des);
+    }
+
+private:
+    MapCache & MCache;
+    df::tile_traffic source, target;
+    bool updown, checkpit, checkbuilding;
+};
+
 command_result filltraffic(Core * c, std::vector<std::string> & params)
 {
     // HOTKEY COMMAND; CORE ALREADY SUSPENDED
 
-    //Maximum map size.
-    uint32_t x_max,y_max,z_max;
     //Source and target traffic types.
     df::tile_traffic source = tile_traffic::Normal;
     df::tile_traffic target = tile_traffic::Normal;
@@ -127,9 +177,6 @@ command_result filltraffic(Core * c, std::vector<std::string> & params)
     }
 
     int32_t cx, cy, cz;
-    Maps::getSize(x_max,y_max,z_max);
-    uint32_t tx_max = x_max * 16;
-    uint32_t ty_max = y_max * 16;
     Gui->getCursorCoords(cx,cy,cz);
     while(cx == -30000)
     {
@@ -138,7 +185,13 @@ command_result filltraffic(Core * c, std::vector<std::string> & params)
     }
 
     DFCoord xy ((uint32_t)cx,(uint32_t)cy,cz);
-    MapExtras::MapCache MCache;
+    MapExtras::MapCache * cache = c->getMapCache();
+    if (!cache)
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    MapExtras::MapCache & MCache = *cache;
 
     df::tile_designation des = MCache.designationAt(xy);
     df::tiletype tt = MCache.tiletypeAt(xy);
@@ -174,68 +227,10 @@ command_result filltraffic(Core * c, std::vector<std::string> & params)
 
     c->con.print("%d/%d/%d  ... FILLING!\n", cx,cy,cz);
 
-    //Naive four-way or six-way flood fill with possible tiles on a stack.
-    stack <DFCoord> flood;
-    flood.push(xy);
-
-    while(!flood.empty())
-    {
-        xy = flood.top();
-        flood.pop();
-
-        des = MCache.designationAt(xy);
-        if (des.bits.traffic != source) continue;
-
-        tt = MCache.tiletypeAt(xy);
-
-        if(isWallTerrain(tt)) continue;
-        if(checkpit && isOpenTerrain(tt)) continue;
-
-        if (checkbuilding)
-        {
-            oc = MCache.occupancyAt(xy);
-            if(oc.bits.building) continue;
-        }
+    //Four-way or six-way flood fill.
+    TrafficFlood policy(MCache, source, target, updown, checkpit, checkbuilding);
+    FloodFill().fill(xy, policy);
 
-        //This tile is ready.  Set its traffic level and add surrounding tiles.
-        if (MCache.testCoord(xy))
-        {
-            des.bits.traffic = target;
-            MCache.setDesignationAt(xy,des);
-
-            if (xy.x > 0)
-            {
-                flood.push(DFCoord(xy.x - 1, xy.y, xy.z));
-            }
-            if (xy.x < tx_max - 1)
-            {
-                flood.push(DFCoord(xy.x + 1, xy.y, xy.z));
-            }
-            if (xy.y > 0)
-            {
-                flood.push(DFCoord(xy.x, xy.y - 1, xy.z));
-            }
-            if (xy.y < ty_max - 1)
-            {
-                flood.push(DFCoord(xy.x, xy.y + 1, xy.z));
-            }
-
-            if (updown)
-            {
-                if (xy.z > 0 && LowPassable(tt))
-                {
-                    flood.push(DFCoord(xy.x, xy.y, xy.z - 1));
-                }
-                if (xy.z < z_max && HighPassable(tt))
-                {
-                    flood.push(DFCoord(xy.x, xy.y, xy.z + 1));
-                }
-            }
-
-        }
-    }
-
-    MCache.WriteAll();
     return CR_OK;
 }
 
@@ -315,7 +310,13 @@ command_result setAllMatching(Core * c, checkTile checkProc,
         return CR_FAILURE;
     }
 
-    MapExtras::MapCache MCache;
+    MapExtras::MapCache * cache = c->getMapCache();
+    if (!cache)
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    MapExtras::MapCache & MCache = *cache;
 
     c->con.print("Setting traffic...\n");
 
@@ -332,7 +333,6 @@ command_result setAllMatching(Core * c, checkTile checkProc,
         }
     }
 
-    MCache.WriteAll();
     c->con.print("Complete!\n");
     return CR_OK;
 }
@@ -35,26 +35,19 @@ bool setTileMaterial(df::tiletype &tile, const df::tiletype_material mat)
     return false;
 }
 
-command_result df_fixveins (Core * c, vector <string> & parameters)
+struct VeinFixer : public Maps::BlockVisitor
 {
-    if (parameters.size())
-        return CR_WRONG_USAGE;
+    int mineral_removed, feature_removed;
+    int mineral_added, feature_added;
 
-    CoreSuspender suspend(c);
+    VeinFixer() : mineral_removed(0), feature_removed(0), mineral_added(0), feature_added(0) {}
 
-    if (!Maps::IsValid())
+    Maps::BlockVisitor * fork()
     {
-        c->con.printerr("Map is not available!\n");
-        return CR_FAILURE;
+        return new VeinFixer();
     }
-
-    int mineral_removed = 0, feature_removed = 0;
-    int mineral_added = 0, feature_added = 0;
-
-    int num_blocks = 0, blocks_total = world->map.map_blocks.size();
-    for (int i = 0; i < blocks_total; i++)
+    void visit(df::map_block *block)
     {
-        df::map_block *block = world->map.map_blocks[i];
         uint16_t has_mineral[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
         for (size_t j = 0; j < block->block_events.size(); j++)
         {
@@ -90,10 +83,36 @@ command_result df_fixveins (Core * c, vector <string> & parameters)
             }
         }
     }
-    if (mineral_removed || feature_removed)
-        c->con.print("Removed invalid references from %i mineral inclusion and %i map feature tiles.\n", mineral_removed, feature_removed);
-    if (mineral_added || feature_added)
-        c->con.print("Restored missing references to %i mineral inclusion and %i map feature tiles.\n", mineral_added, feature_added);
+    void merge(Maps::BlockVisitor * part)
+    {
+        VeinFixer * other = (VeinFixer *) part;
+        mineral_removed += other->mineral_removed;
+        feature_removed += other->feature_removed;
+        mineral_added += other->mineral_added;
+        feature_added += other->feature_added;
+    }
+};
+
+command_result df_fixveins (Core * c, vector <string> & parameters)
+{
+    if (parameters.size())
+        return CR_WRONG_USAGE;
+
+    CoreSuspender suspend(c);
+
+    if (!Maps::IsValid())
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+
+    // every block only touches its own tiles
+    VeinFixer fix;
+    Maps::forEachBlock(fix);
+    if (fix.mineral_removed || fix.feature_removed)
+        c->con.print("Removed invalid references from %i mineral inclusion and %i map feature tiles.\n", fix.mineral_removed, fix.feature_removed);
+    if (fix.mineral_added || fix.feature_added)
+        c->con.print("Restored missing references to %i mineral inclusion and %i map feature tiles.\n", fix.mineral_added, fix.feature_added);
     return CR_OK;
 }
 
@@ -6,6 +6,7 @@
 #include "PluginManager.h"
 
 #include "DataDefs.h"
+#include "modules/Maps.h"
 #include "df/world.h"
 #include "df/map_block.h"
 #include "df/tile_liquid.h"
@@ -13,20 +14,21 @@
 using std::string;
 using std::vector;
 using namespace DFHack;
+using namespace DFHack::Simple;
 using namespace df::enums;
 
-using df::global::world;
-
-command_result df_flows (Core * c, vector <string> & parameters)
+struct FlowCounter : public Maps::BlockVisitor
 {
-    CoreSuspender suspend(c);
+    int flow1, flow2, flowboth, water, magma;
 
-    int flow1 = 0, flow2 = 0, flowboth = 0, water = 0, magma = 0;
-    c->con.print("Counting flows and liquids ...\n");
+    FlowCounter() : flow1(0), flow2(0), flowboth(0), water(0), magma(0) {}
 
-    for (size_t i = 0; i < world->map.map_blocks.size(); i++)
+    Maps::BlockVisitor * fork()
+    {
+        return new FlowCounter();
+    }
+    void visit(df::map_block *cur)
     {
-        df::map_block *cur = world->map.map_blocks[i];
         if (cur->flags.bits.update_liquid)
             flow1++;
         if (cur->flags.bits.update_liquid_twice)
@@ -47,12 +49,37 @@ command_result df_flows (Core * c, vector <string> & parameters)
             }
         }
     }
+    void merge(Maps::BlockVisitor * part)
+    {
+        FlowCounter * other = (FlowCounter *) part;
+        flow1 += other->flow1;
+        flow2 += other->flow2;
+        flowboth += other->flowboth;
+        water += other->water;
+        magma += other->magma;
+    }
+};
+
+command_result df_flows (Core * c, vector <string> & parameters)
+{
+    CoreSuspender suspend(c);
+
+    if (!Maps::IsValid())
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+
+    c->con.print("Counting flows and liquids ...\n");
+
+    FlowCounter count;
+    Maps::forEachBlock(count);
 
-    c->con.print("Blocks with liquid_1=true: %d\n", flow1);
-    c->con.print("Blocks with liquid_2=true: %d\n", flow2);
-    c->con.print("Blocks with both:          %d\n", flowboth);
-    c->con.print("Water tiles:               %d\n", water);
-    c->con.print("Magma tiles:               %d\n", magma);
+    c->con.print("Blocks with liquid_1=true: %d\n", count.flow1);
+    c->con.print("Blocks with liquid_2=true: %d\n", count.flow2);
+    c->con.print("Blocks with both:          %d\n", count.flowboth);
+    c->con.print("Water tiles:               %d\n", count.water);
+    c->con.print("Magma tiles:               %d\n", count.magma);
     return CR_OK;
 }
 
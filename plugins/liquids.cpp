@@ -1,9 +1,9 @@
 #include <iostream>
 #include <vector>
-#include <stack>
 #include <map>
 #include <set>
 #include <cstdlib>
+#include <algorithm>
 #include <sstream>
 using std::vector;
 using std::string;
@@ -19,185 +19,56 @@ using std::set;
 #include "modules/Gui.h"
 #include "TileTypes.h"
 #include "modules/MapCache.h"
+#include "modules/FloodFill.h"
+#include "modules/Brushes.h"
 using namespace MapExtras;
 using namespace DFHack;
 using namespace df::enums;
-typedef vector <df::coord> coord_vec;
-
-class Brush
-{
-public:
-    virtual ~Brush(){};
-    virtual coord_vec points(MapCache & mc,DFHack::DFCoord start) = 0;
-};
 /**
- * generic 3D rectangle brush. you can specify the dimensions of
- * the rectangle and optionally which tile is its 'center'
+ * Flood-fill water tiles from cursor (for wclean)
+ * example: remove salt flag from a river
  */
-class RectangleBrush : public Brush
+class FloodBrush : public TileBrush
 {
 public:
-    RectangleBrush(int x, int y, int z = 1, int centerx = -1, int centery = -1, int centerz = -1)
-    {
-        if(centerx == -1)
-            cx_ = x/2;
-        else
-            cx_ = centerx;
-        if(centery == -1)
-            cy_ = y/2;
-        else
-            cy_ = centery;
-        if(centerz == -1)
-            cz_ = z/2;
-        else
-            cz_ = centerz;
-        x_ = x;
-        y_ = y;
-        z_ = z;
-    };
-    coord_vec points(MapCache & mc, DFHack::DFCoord start)
+    FloodBrush(Core *c){c_ = c;};
+    ~FloodBrush(){};
+    void begin(MapCache & mc, DFHack::DFCoord start)
     {
-        coord_vec v;
-        DFHack::DFCoord iterstart(start.x - cx_, start.y - cy_, start.z - cz_);
-        DFHack::DFCoord iter = iterstart;
-        for(int xi = 0; xi < x_; xi++)
-        {
-            for(int yi = 0; yi < y_; yi++)
-            {
-                for(int zi = 0; zi < z_; zi++)
-                {
-                    if(mc.testCoord(iter))
-                        v.push_back(iter);
-                    iter.z++;
-                }
-                iter.z = iterstart.z;
-                iter.y++;
-            }
-            iter.y = iterstart.y;
-            iter.x ++;
-        }
-        return v;
-    };
-    ~RectangleBrush(){};
+        clear();
+        WaterFlood water(mc, *this);
+        FloodFill().fill(start, water);
+    }
 private:
-    int x_, y_, z_;
-    int cx_, cy_, cz_;
-};
-
-/**
- * stupid block brush, legacy. use when you want to apply something to a whole DF map block.
- */
-class BlockBrush : public Brush
-{
-public:
-    BlockBrush(){};
-    ~BlockBrush(){};
-    coord_vec points(MapCache & mc, DFHack::DFCoord start)
+    // collects the connected water tiles
+    class WaterFlood : public FloodPolicy
     {
-        coord_vec v;
-        DFHack::DFCoord blockc = start / 16;
-        DFHack::DFCoord iterc = blockc * 16;
-        if( !mc.testCoord(start) )
-            return v;
-        auto starty = iterc.y;
-        for(int xi = 0; xi < 16; xi++)
+    public:
+        WaterFlood(MapCache & mc, FloodBrush & brush) : mc(mc), brush(brush) {};
+        int enter(DFCoord xy, Direction from)
         {
-            for(int yi = 0; yi < 16; yi++)
-            {
-                v.push_back(iterc);
-                iterc.y++;
-            }
-            iterc.y = starty;
-            iterc.x ++;
+            if (!mc.testCoord(xy))
+                return STOP;
+            df::tile_designation des = mc.designationAt(xy);
+            if (!des.bits.flow_size || des.bits.liquid_type != tile_liquid::Water)
+                return STOP;
+            int act = SPREAD;
+            df::tiletype tt = mc.tiletypeAt(xy);
+            if (LowPassable(tt))
+                act |= DOWN;
+            if (HighPassable(tt))
+                act |= UP;
+            return act;
         }
-        return v;
-    };
-};
-
-/**
- * Column from a position through open space tiles
- * example: create a column of magma
- */
-class ColumnBrush : public Brush
-{
-public:
-    ColumnBrush(){};
-    ~ColumnBrush(){};
-    coord_vec points(MapCache & mc, DFHack::DFCoord start)
-    {
-        coord_vec v;
-        bool juststarted = true;
-        while (mc.testCoord(start))
+        void visit(DFCoord xy, Direction from)
         {
-            df::tiletype tt = mc.tiletypeAt(start);
-            if(DFHack::LowPassable(tt) || juststarted && DFHack::HighPassable(tt))
-            {
-                v.push_back(start);
-                juststarted = false;
-                start.z++;
-            }
-            else break;
+            brush.add(xy);
         }
-        return v;
+    private:
+        MapCache & mc;
+        FloodBrush & brush;
     };
-};
-
-/**
- * Flood-fill water tiles from cursor (for wclean)
- * example: remove salt flag from a river
- */
-class FloodBrush : public Brush
-{
-public:
-    FloodBrush(Core *c){c_ = c;};
-    ~FloodBrush(){};
-    coord_vec points(MapCache & mc, DFHack::DFCoord start)
-    {
-        coord_vec v;
-
-		std::stack<DFCoord> to_flood;
-	    to_flood.push(start);
-
-		std::set<DFCoord> seen;
-
-		while (!to_flood.empty()) {
-			DFCoord xy = to_flood.top();
-			to_flood.pop();
-
-                        df::tile_designation des = mc.designationAt(xy);
-
-			if (seen.find(xy) == seen.end() 
-                            && des.bits.flow_size
-                            && des.bits.liquid_type == tile_liquid::Water) {
-				v.push_back(xy);
-				seen.insert(xy);
-
-				maybeFlood(DFCoord(xy.x - 1, xy.y, xy.z), to_flood, mc);
-				maybeFlood(DFCoord(xy.x + 1, xy.y, xy.z), to_flood, mc);
-				maybeFlood(DFCoord(xy.x, xy.y - 1, xy.z), to_flood, mc);
-				maybeFlood(DFCoord(xy.x, xy.y + 1, xy.z), to_flood, mc);
-
-				df::tiletype tt = mc.tiletypeAt(xy);
-				if (LowPassable(tt))
-				{
-					maybeFlood(DFCoord(xy.x, xy.y, xy.z - 1), to_flood, mc);
-				}
-				if (HighPassable(tt))
-				{
-					maybeFlood(DFCoord(xy.x, xy.y, xy.z + 1), to_flood, mc);
-				}
-			}
-		}
-
-		return v;
-	}
-private:
-	void maybeFlood(DFCoord c, std::stack<DFCoord> &to_flood, MapCache &mc) {
-		if (mc.testCoord(c)) {
-			to_flood.push(c);
-		}
-	}
-	Core *c_;
+    Core *c_;
 };
 
 CommandHistory liquids_hist;
@@ -446,94 +317,95 @@ command_result df_liquids (Core * c, vector <string> & parameters)
                     break;
                 }
                 c->con << "cursor coords: " << x << "/" << y << "/" << z << endl;
-                MapCache mcache;
+                MapCache * cache = c->getMapCache();
+                if(!cache)
+                {
+                    c->con << "Can't see any DF map loaded." << endl;
+                    break;
+                }
+                MapCache & mcache = *cache;
                 DFHack::DFCoord cursor(x,y,z);
-                coord_vec all_tiles = brush->points(mcache,cursor);
+                brush->begin(mcache,cursor);
                 c->con << "working..." << endl;
-                if(mode == "obsidian")
+                BlockMask mask;
+                while (brush->next(mask))
                 {
-                    coord_vec::iterator iter = all_tiles.begin();
-                    while (iter != all_tiles.end())
+                    Block * b = mcache.BlockAt(mask.block);
+                    if(mode == "obsidian")
                     {
-                        mcache.setTiletypeAt(*iter, tiletype::LavaWall);
-                        mcache.setTemp1At(*iter,10015);
-                        mcache.setTemp2At(*iter,10015);
-                        df::tile_designation des = mcache.designationAt(*iter);
-                        des.bits.flow_size = 0;
-                        mcache.setDesignationAt(*iter, des);
-                        iter ++;
+                        for(int x = 0; x < 16; x++) for(int y = 0; y < 16; y++)
+                        {
+                            if(!mask.has(x,y))
+                                continue;
+                            df::coord2d p(x,y);
+                            b->setTiletypeAt(p, tiletype::LavaWall);
+                            b->setTemp1At(p,10015);
+                            b->setTemp2At(p,10015);
+                            df::tile_designation des = b->DesignationAt(p);
+                            des.bits.flow_size = 0;
+                            b->setDesignationAt(p, des);
+                        }
                     }
-                }
-                if(mode == "obsidian_floor")
-                {
-                    coord_vec::iterator iter = all_tiles.begin();
-                    while (iter != all_tiles.end())
+                    if(mode == "obsidian_floor")
                     {
-                        mcache.setTiletypeAt(*iter, findRandomVariant(tiletype::LavaFloor1));
-                        iter ++;
+                        for(int x = 0; x < 16; x++) for(int y = 0; y < 16; y++)
+                        {
+                            if(mask.has(x,y))
+                                b->setTiletypeAt(df::coord2d(x,y), findRandomVariant(tiletype::LavaFloor1));
+                        }
                     }
-                }
-                else if(mode == "riversource")
-                {
-                    coord_vec::iterator iter = all_tiles.begin();
-                    while (iter != all_tiles.end())
+                    else if(mode == "riversource")
                     {
-                        mcache.setTiletypeAt(*iter, tiletype::RiverSource);
-
-                        df::tile_designation a = mcache.designationAt(*iter);
-                        a.bits.liquid_type = tile_liquid::Water;
-                        a.bits.liquid_static = false;
-                        a.bits.flow_size = 7;
-                        mcache.setTemp1At(*iter,10015);
-                        mcache.setTemp2At(*iter,10015);
-                        mcache.setDesignationAt(*iter,a);
+                        for(int x = 0; x < 16; x++) for(int y = 0; y < 16; y++)
+                        {
+                            if(!mask.has(x,y))
+                                continue;
+                            df::coord2d p(x,y);
+                            b->setTiletypeAt(p, tiletype::RiverSource);
 
-                        Block * b = mcache.BlockAt((*iter)/16);
+                            df::tile_designation a = b->DesignationAt(p);
+                            a.bits.liquid_type = tile_liquid::Water;
+                            a.bits.liquid_static = false;
+                            a.bits.flow_size = 7;
+                            b->setTemp1At(p,10015);
+                            b->setTemp2At(p,10015);
+                            b->setDesignationAt(p,a);
+                        }
                         DFHack::t_blockflags bf = b->BlockFlags();
                         bf.bits.liquid_1 = true;
                         bf.bits.liquid_2 = true;
                         b->setBlockFlags(bf);
-
-                        iter++;
                     }
-                }
-                else if(mode=="wclean")
-                {
-                    coord_vec::iterator iter = all_tiles.begin();
-                    while (iter != all_tiles.end())
+                    else if(mode=="wclean")
                     {
-                        DFHack::DFCoord current = *iter;
-                        df::tile_designation des = mcache.designationAt(current);
-                        des.bits.water_salt = false;
-                        des.bits.water_stagnant = false;
-                        mcache.setDesignationAt(current,des);
-                        iter++;
-                    }
-                }
-                else if(mode== "magma" || mode== "water" || mode == "flowbits")
-                {
-                    set <Block *> seen_blocks;
-                    coord_vec::iterator iter = all_tiles.begin();
-                    while (iter != all_tiles.end())
-                    {
-                        DFHack::DFCoord current = *iter; // current tile coord
-                        DFHack::DFCoord curblock = current /16; // current block coord
-                        // check if the block is actually there
-                        if(!mcache.BlockAt(curblock))
-                        {
-                            iter ++;
-                            continue;
-                        }
-                        df::tile_designation des = mcache.designationAt(current);
-                        df::tiletype tt = mcache.tiletypeAt(current);
-                        // don't put liquids into places where they don't belong...
-                        if(!DFHack::FlowPassable(tt))
+                        for(int x = 0; x < 16; x++) for(int y = 0; y < 16; y++)
                         {
-                            iter++;
-                            continue;
+                            if(!mask.has(x,y))
+                                continue;
+                            df::coord2d p(x,y);
+                            df::tile_designation des = b->DesignationAt(p);
+                            des.bits.water_salt = false;
+                            des.bits.water_stagnant = false;
+                            b->setDesignationAt(p,des);
                         }
-                        if(mode != "flowbits")
+                    }
+                    else if(mode== "magma" || mode== "water" || mode == "flowbits")
+                    {
+                        // flow bits only change for blocks that could get liquid
+                        bool flowing = false;
+                        for(int x = 0; x < 16; x++) for(int y = 0; y < 16; y++)
                         {
+                            if(!mask.has(x,y))
+                                continue;
+                            df::coord2d p(x,y);
+                            df::tile_designation des = b->DesignationAt(p);
+                            df::tiletype tt = b->TileTypeAt(p);
+                            // don't put liquids into places where they don't belong...
+                            if(!DFHack::FlowPassable(tt))
+                                continue;
+                            flowing = true;
+                            if(mode == "flowbits")
+                                continue;
                             if(setmode == "s.")
                             {
                                 des.bits.flow_size = amount;
@@ -551,48 +423,43 @@ command_result df_liquids (Core * c, vector <string> & parameters)
                             if(amount != 0 && mode == "magma")
                             {
                                 des.bits.liquid_type =  tile_liquid::Magma;
-                                mcache.setTemp1At(current,12000);
-                                mcache.setTemp2At(current,12000);
+                                b->setTemp1At(p,12000);
+                                b->setTemp2At(p,12000);
                             }
                             else if(amount != 0 && mode == "water")
                             {
                                 des.bits.liquid_type =  tile_liquid::Water;
-                                mcache.setTemp1At(current,10015);
-                                mcache.setTemp2At(current,10015);
+                                b->setTemp1At(p,10015);
+                                b->setTemp2At(p,10015);
                             }
                             else if(amount == 0 && (mode == "water" || mode == "magma"))
                             {
                                 // reset temperature to sane default
-                                mcache.setTemp1At(current,10015);
-                                mcache.setTemp2At(current,10015);
+                                b->setTemp1At(p,10015);
+                                b->setTemp2At(p,10015);
                             }
-                            mcache.setDesignationAt(current,des);
+                            b->setDesignationAt(p,des);
                         }
-                        seen_blocks.insert(mcache.BlockAt(current / 16));
-                        iter++;
-                    }
-                    set <Block *>::iterator biter = seen_blocks.begin();
-                    while (biter != seen_blocks.end())
-                    {
-                        DFHack::t_blockflags bflags = (*biter)->BlockFlags();
+                        if(!flowing)
+                            continue;
+                        DFHack::t_blockflags bflags = b->BlockFlags();
                         if(flowmode == "f+")
                         {
                             bflags.bits.liquid_1 = true;
                             bflags.bits.liquid_2 = true;
-                            (*biter)->setBlockFlags(bflags);
+                            b->setBlockFlags(bflags);
                         }
                         else if(flowmode == "f-")
                         {
                             bflags.bits.liquid_1 = false;
                             bflags.bits.liquid_2 = false;
-                            (*biter)->setBlockFlags(bflags);
+                            b->setBlockFlags(bflags);
                         }
                         else
                         {
                             c->con << "flow bit 1 = " << bflags.bits.liquid_1 << endl; 
                             c->con << "flow bit 2 = " << bflags.bits.liquid_2 << endl;
                         }
-                        biter ++;
                     }
                 }
                 if(mcache.WriteAll())
@@ -13,7 +13,6 @@ using namespace google::protobuf::io;
 
 #include "DataDefs.h"
 #include "df/world.h"
-#include "modules/Constructions.h"
 
 #include "proto/Map.pb.h"
 #include "proto/Block.pb.h"
@@ -79,6 +78,14 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
         return CR_FAILURE;
     }
 
+    MapExtras::MapCache * cache = c->getMapCache();
+    if (!cache)
+    {
+        c->con.printerr("Map is not available!\n");
+        c->Resume();
+        return CR_FAILURE;
+    }
+
     if (parameters.size() < filenameParameter)
     {
         c->con.printerr("Please supply a filename.\n");
@@ -104,7 +111,9 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
     coded_output->WriteLittleEndian32(0x50414DDF); //Write our file header
 
     Maps::getSize(x_max, y_max, z_max);
-    MapExtras::MapCache map;
+    MapExtras::MapCache & map = *cache;
+    // we go through the whole map once, no need to keep it all around
+    map.setMemoryLimit(32 << 20);
     DFHack::Materials *mats = c->getMaterials();
 
     c->con << "Writing  map info..." << std::endl;
@@ -130,21 +139,10 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
         protomaterial->set_name(world->raws.plants.all[i]->id);
     }
 
-    std::map<df::coord,std::pair<uint32_t,uint16_t> > constructionMaterials;
-    if (Constructions::isValid())
-    {
-        for (uint32_t i = 0; i < Constructions::getCount(); i++)
-        {
-            df::construction *construction = Constructions::getConstruction(i);
-            constructionMaterials[construction->pos] = std::make_pair(construction->mat_index, construction->mat_type);
-        }
-    }
-        
     coded_output->WriteVarint32(protomap.ByteSize());
     protomap.SerializeToCodedStream(coded_output);
     
-    DFHack::t_feature blockFeatureGlobal;
-    DFHack::t_feature blockFeatureLocal;
+    MapExtras::t_tilematerials tileMaterials;
 
     c->con.print("Writing map block information");
 
@@ -156,7 +154,6 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
             {
                 if (b_x == 0 && b_y == 0 && z % 10 == 0) c->con.print(".");
                 // Get the map block
-                df::coord2d blockCoord(b_x, b_y);
                 MapExtras::Block *b = map.BlockAt(DFHack::DFCoord(b_x, b_y, z));
                 if (!b || !b->valid)
                 {
@@ -168,15 +165,7 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
                 protoblock.set_y(b_y);
                 protoblock.set_z(z);
 
-                { // Find features
-                    uint32_t index = b->raw.global_feature;
-                    if (index != -1)
-                        Maps::GetGlobalFeature(blockFeatureGlobal, index);
-
-                    index = b->raw.local_feature;
-                    if (index != -1)
-                        Maps::GetLocalFeature(blockFeatureLocal, blockCoord, index);
-                }
+                map.materialsAt(DFHack::DFCoord(b_x, b_y, z), tileMaterials);
 
                 int global_z = df::global::world->map.region_z + z;
 
@@ -211,44 +200,11 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
 
                         prototile->set_material_type((dfproto::Tile::TileMaterialType)tileMaterial(type));
 
-                        df::coord map_pos = df::coord(b_x*16+x,b_y*16+y,z);
-                        
-                        switch (tileMaterial(type))
+                        MapExtras::TileMaterial & mat = tileMaterials[x][y];
+                        if (mat.mat_type != -1)
                         {
-                        case tiletype_material::SOIL:
-                        case tiletype_material::STONE:
-                            prototile->set_material_type(0);
-                            prototile->set_material_index(b->baseMaterialAt(coord));
-                            break;
-                        case tiletype_material::MINERAL:
-                            prototile->set_material_type(0);
-                            prototile->set_material_index(b->veinMaterialAt(coord));
-                            break;
-                        case tiletype_material::FEATURE:
-                            if (blockFeatureLocal.type != -1 && des.bits.feature_local)
-                            {
-                                if (blockFeatureLocal.type == feature_type::deep_special_tube
-                                        && blockFeatureLocal.main_material == 0) // stone
-                                {
-                                    prototile->set_material_type(0);
-                                    prototile->set_material_index(blockFeatureLocal.sub_material);
-                                }
-                                if (blockFeatureGlobal.type != -1 && des.bits.feature_global
-                                        && blockFeatureGlobal.type == feature_type::feature_underworld_from_layer
-                                        && blockFeatureGlobal.main_material == 0) // stone
-                                {
-                                    prototile->set_material_type(0);
-                                    prototile->set_material_index(blockFeatureGlobal.sub_material);
-                                }
-                            }
-                            break;
-                        case tiletype_material::CONSTRUCTION:
-                            if (constructionMaterials.find(map_pos) != constructionMaterials.end())
-                            {
-                                prototile->set_material_index(constructionMaterials[map_pos].first);
-                                prototile->set_material_type(constructionMaterials[map_pos].second);
-                            }
-                            break;
+                            prototile->set_material_type(mat.mat_type);
+                            prototile->set_material_index(mat.mat_index);
                         }
                     }
                 }
@@ -275,8 +231,6 @@ command_result mapexport (Core * c, std::vector <std::string> & parameters)
                 coded_output->WriteVarint32(protoblock.ByteSize());
                 protoblock.SerializeToCodedStream(coded_output);
             } // block x
-            // Clean uneeded memory
-            map.trash();
         } // block y
     } // z
 
@@ -144,7 +144,7 @@ command_result df_probe (Core * c, vector <string> & parameters)
     }
 */
     df::tiletype tiletype = mc.tiletypeAt(cursor);
-    df::tile_designation &des = block.designation[tileX][tileY];
+    df::tile_designation des = mc.designationAt(cursor);
 /*
     if(showDesig)
     {
@@ -216,6 +216,9 @@ command_result df_probe (Core * c, vector <string> & parameters)
         else
             con << endl;
     }
+    MapExtras::TileMaterial tile_mat = mc.materialAt(cursor);
+    if(tile_mat.mat_type != -1)
+        con << "Tile material: " << dec << tile_mat.mat_type << " / " << tile_mat.mat_index << endl;
     // liquids
     if(des.bits.flow_size)
     {
@@ -4,11 +4,13 @@
 //  -p : don't show plants
 //  -s : don't show slade
 //  -t : don't show demon temple
+//  veins : also count the separate veins of each mineral
 
 //#include <cstdlib>
 #include <iostream>
 #include <iomanip>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <vector>
 
@@ -17,6 +19,7 @@ using namespace std;
 #include "Console.h"
 #include "Export.h"
 #include "PluginManager.h"
+#include "modules/Maps.h"
 #include "modules/MapCache.h"
 
 #include "MiscUtils.h"
@@ -196,6 +199,8 @@ DFhackCExport command_result plugin_init ( Core * c, std::vector <PluginCommand>
         "  all   - Scan the whole map, as if it was revealed.\n"
         "  value - Show material value in the output. Most useful for gems.\n"
         "  hell  - Show the Z range of HFS tubes. Implies 'all'.\n"
+        "  veins - Also count the separate veins of each mineral and\n"
+        "          show the size of the biggest one. Implies 'all'.\n"
         "Pre-embark estimate:\n"
         "  If called during the embark selection screen, displays\n"
         "  an estimate of layer stone availability. If the 'all'\n"
@@ -353,6 +358,7 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
     bool showTemple = true;
     bool showValue = false;
     bool showTube = false;
+    bool showVeins = false;
     Console & con = c->con;
     for(size_t i = 0; i < parameters.size();i++)
     {
@@ -368,6 +374,10 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
         {
             showHidden = showTube = true;
         }
+        else if (parameters[i] == "veins")
+        {
+            showHidden = showVeins = true;
+        }
         else
             return CR_WRONG_USAGE;
     }
@@ -385,7 +395,15 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
 
     uint32_t x_max = 0, y_max = 0, z_max = 0;
     Maps::getSize(x_max, y_max, z_max);
-    MapExtras::MapCache map;
+    MapExtras::MapCache * cache = c->getMapCache();
+    if (!cache)
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    MapExtras::MapCache & map = *cache;
+    // we go through the whole map once, no need to keep it all around
+    map.setMemoryLimit(32 << 20);
 
     DFHack::Materials *mats = c->getMaterials();
 
@@ -408,6 +426,14 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
 
     uint32_t vegCount = 0;
 
+    // the veins each mineral is found in
+    std::map<int16_t, std::set<uint32_t> > veinBodies;
+    // the block summaries go by the generations
+    if (showVeins)
+        Maps::updateVeins();
+    else
+        Maps::updateGenerations();
+
     for(uint32_t z = 0; z < z_max; z++)
     {
         for(uint32_t b_y = 0; b_y < y_max; b_y++)
@@ -416,6 +442,15 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
             {
                 // Get the map block
                 df::coord2d blockCoord(b_x, b_y);
+
+                // Nothing to count in blocks that are all hidden
+                if (!showHidden)
+                {
+                    const Maps::BlockSummary * summary = Maps::getBlockSummary(b_x, b_y, z);
+                    if (summary && summary->allHidden())
+                        continue;
+                }
+
                 MapExtras::Block *b = map.BlockAt(DFHack::DFCoord(b_x, b_y, z));
                 if (!b || !b->valid)
                 {
@@ -507,6 +542,12 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
                             break;
                         case tiletype_material::MINERAL:
                             veinMats[b->veinMaterialAt(coord)].add(global_z);
+                            if (showVeins)
+                            {
+                                uint32_t vein = Maps::getVein(b_x * 16 + x, b_y * 16 + y, z);
+                                if (vein)
+                                    veinBodies[Maps::getVeinMaterial(vein)].insert(vein);
+                            }
                             break;
                         case tiletype_material::FEATURE:
                             if (blockFeatureLocal.type != -1 && des.bits.feature_local)
@@ -561,9 +602,6 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
                 }
                 // Block end
             } // block x
-
-            // Clean uneeded memory
-            map.trash();
         } // block y
     } // z
 
@@ -595,6 +633,25 @@ command_result prospector (DFHack::Core * c, vector <string> & parameters)
 
     printVeins(con, veinMats, mats, showValue);
 
+    if (showVeins)
+    {
+        con << "Separate veins:" << std::endl;
+        std::map<int16_t, std::set<uint32_t> >::const_iterator vit;
+        for (vit = veinBodies.begin(); vit != veinBodies.end(); ++vit)
+        {
+            if (vit->first < 0 || vit->first >= world->raws.inorganics.size())
+                continue;
+            size_t biggest = 0;
+            std::set<uint32_t>::const_iterator bit;
+            for (bit = vit->second.begin(); bit != vit->second.end(); ++bit)
+                biggest = std::max(biggest, Maps::getVeinSize(*bit));
+            con << std::setw(25) << world->raws.inorganics[vit->first]->id << " : "
+                << std::setw(9) << vit->second.size() << " veins, biggest "
+                << biggest << std::endl;
+        }
+        con << std::endl;
+    }
+
     if (showPlants)
     {
         con << "Shrubs:" << std::endl;
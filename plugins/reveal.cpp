@@ -9,8 +9,11 @@
 #include "modules/Maps.h"
 #include "modules/World.h"
 #include "modules/MapCache.h"
+#include "modules/FloodFill.h"
 #include "modules/Gui.h"
 using MapExtras::MapCache;
+using MapExtras::FloodFill;
+using MapExtras::FloodPolicy;
 using namespace DFHack;
 using namespace df::enums;
 using df::global::world;
@@ -292,6 +295,57 @@ command_result revtoggle (DFHack::Core * c, std::vector<std::string> & params)
     }
 }
 
+// reveals what can be seen walking from the start of the fill
+class RevealFlood : public FloodPolicy
+{
+public:
+    RevealFlood(MapCache & mc) : mc(mc) {}
+    int enter(DFCoord pos, Direction from)
+    {
+        if(!mc.testCoord(pos))
+            return STOP;
+        // by tile shape, determine behavior
+        switch (tileShape(mc.tiletypeAt(pos)))
+        {
+        // walls, can't be seen from below
+        case tiletype_shape::WALL:
+            return from == BELOW ? STOP : VISIT;
+        // air/free space
+        case tiletype_shape::EMPTY:
+        case tiletype_shape::RAMP_TOP:
+        case tiletype_shape::STAIR_UPDOWN:
+        case tiletype_shape::STAIR_DOWN:
+        case tiletype_shape::BROOK_TOP:
+            return SPREAD | UP | DOWN;
+        // has floor
+        case tiletype_shape::FORTIFICATION:
+        case tiletype_shape::STAIR_UP:
+        case tiletype_shape::RAMP:
+        case tiletype_shape::FLOOR:
+        case tiletype_shape::TREE:
+        case tiletype_shape::SAPLING:
+        case tiletype_shape::SHRUB:
+        case tiletype_shape::BOULDER:
+        case tiletype_shape::PEBBLES:
+        case tiletype_shape::BROOK_BED:
+        case tiletype_shape::RIVER_BED:
+        case tiletype_shape::ENDLESS_PIT:
+        case tiletype_shape::POOL:
+            return SPREAD | UP;
+        default:
+            return VISIT;
+        }
+    }
+    void visit(DFCoord pos, Direction from)
+    {
+        df::tile_designation des = mc.designationAt(pos);
+        des.bits.hidden = false;
+        mc.setDesignationAt(pos,des);
+    }
+private:
+    MapCache & mc;
+};
+
 command_result revflood(DFHack::Core * c, std::vector<std::string> & params)
 {
     for(size_t i = 0; i < params.size();i++)
@@ -337,12 +391,18 @@ command_result revflood(DFHack::Core * c, std::vector<std::string> & params)
         return CR_FAILURE;
     }
     DFCoord xy ((uint32_t)cx,(uint32_t)cy,cz);
-    MapCache * MCache = new MapCache;
+    MapCache * MCache = c->getMapCache();
+    if(!MCache)
+    {
+        c->con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    // the flood can reach every block of the map
+    MCache->setMemoryLimit(64 << 20);
     df::tiletype tt = MCache->tiletypeAt(xy);
     if(isWallTerrain(tt))
     {
         c->con.printerr("Point the cursor at some empty space you want to be unhidden.\n");
-        delete MCache;
         return CR_FAILURE;
     }
     // hide all tiles, flush cache
@@ -359,90 +419,7 @@ command_result revflood(DFHack::Core * c, std::vector<std::string> & params)
     }
     MCache->trash();
 
-    typedef std::pair <DFCoord, bool> foo;
-    std::stack < foo > flood;
-    flood.push( foo(xy,false) );
-
-    while( !flood.empty() )
-    {
-        foo tile = flood.top();
-        DFCoord & current = tile.first;
-        bool & from_below = tile.second;
-        flood.pop();
-
-        if(!MCache->testCoord(current))
-            continue;
-        df::tiletype tt = MCache->tiletypeAt(current);
-        df::tile_designation des = MCache->designationAt(current);
-        if(!des.bits.hidden)
-        {
-            continue;
-        }
-        bool below = 0;
-        bool above = 0;
-        bool sides = 0;
-        bool unhide = 1;
-        // by tile shape, determine behavior and action
-        switch (tileShape(tt))
-        {
-        // walls:
-        case tiletype_shape::WALL:
-            if(from_below)
-                unhide = 0;
-            break;
-        // air/free space
-        case tiletype_shape::EMPTY:
-        case tiletype_shape::RAMP_TOP:
-        case tiletype_shape::STAIR_UPDOWN:
-        case tiletype_shape::STAIR_DOWN:
-        case tiletype_shape::BROOK_TOP:
-            above = below = sides = true;
-            break;
-        // has floor
-        case tiletype_shape::FORTIFICATION:
-        case tiletype_shape::STAIR_UP:
-        case tiletype_shape::RAMP:
-        case tiletype_shape::FLOOR:
-        case tiletype_shape::TREE:
-        case tiletype_shape::SAPLING:
-        case tiletype_shape::SHRUB:
-        case tiletype_shape::BOULDER:
-        case tiletype_shape::PEBBLES:
-        case tiletype_shape::BROOK_BED:
-        case tiletype_shape::RIVER_BED:
-        case tiletype_shape::ENDLESS_PIT:
-        case tiletype_shape::POOL:
-            if(from_below)
-                unhide = 0;
-            above = sides = true;
-            break;
-        }
-        if(unhide)
-        {
-            des.bits.hidden = false;
-            MCache->setDesignationAt(current,des);
-        }
-        if(sides)
-        {
-            flood.push(foo(DFCoord(current.x + 1, current.y ,current.z),0));
-            flood.push(foo(DFCoord(current.x + 1, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y + 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y ,current.z),0));
-            flood.push(foo(DFCoord(current.x - 1, current.y - 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x, current.y - 1 ,current.z),0));
-            flood.push(foo(DFCoord(current.x + 1, current.y - 1 ,current.z),0));
-        }
-        if(above)
-        {
-            flood.push(foo(DFCoord(current.x, current.y ,current.z + 1),1));
-        }
-        if(below)
-        {
-            flood.push(foo(DFCoord(current.x, current.y ,current.z - 1),0));
-        }
-    }
-    MCache->WriteAll();
-    delete MCache;
+    RevealFlood policy(*MCache);
+    FloodFill(true).fill(xy, policy);
     return CR_OK;
 }
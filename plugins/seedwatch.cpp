@@ -43,6 +43,13 @@ bool ignoreSeeds(df::item_flags& f) // seeds with the following flags should not
         f.bits.in_job;
 };
 
+void setRunning(Core& core, bool state) // starts or stops supervision
+{
+    running = state;
+    // reduce processing rate
+    core.getPluginManager()->setUpdateSchedule("seedwatch", running ? US_FRAMES : US_NEVER, 500);
+}
+
 void printHelp(Core& core) // prints help
 {
     core.con.print(
@@ -137,12 +144,12 @@ command_result df_seedwatch(Core* pCore, vector<string>& parameters)
         else if(par == "?") printHelp(core);
         else if(par == "start")
         {
-            running = true;
+            setRunning(core, true);
             core.con.print("seedwatch supervision started.\n");
         }
         else if(par == "stop")
         {
-            running = false;
+            setRunning(core, false);
             core.con.print("seedwatch supervision stopped.\n");
         }
         else if(par == "clear")
@@ -276,6 +283,7 @@ DFhackCExport command_result plugin_init(Core* pCore, vector<PluginCommand>& com
     abbreviations["vh"] = "HERB_VALLEY";
     abbreviations["ws"] = "BERRIES_STRAW_WILD";
     abbreviations["wv"] = "VINE_WHIP";
+    setRunning(*pCore, running);
     return CR_OK;
 }
 
@@ -286,7 +294,7 @@ DFhackCExport command_result plugin_onstatechange(Core* pCore, state_change_even
     case SC_GAME_UNLOADED:
         if (running)
             pCore->con.printerr("seedwatch deactivated due to game load/unload\n");
-        running = false;
+        setRunning(*pCore, false);
         break;
     default:
         break;
@@ -299,12 +307,6 @@ DFhackCExport command_result plugin_onupdate(Core* pCore)
 {
     if (running)
     {
-        // reduce processing rate
-        static int counter = 0;
-        if (++counter < 500)
-            return CR_OK;
-        counter = 0;
-
         Core& core = *pCore;
         World *w = core.getWorld();
         t_gamemodes gm;
@@ -313,7 +315,7 @@ DFhackCExport command_result plugin_onupdate(Core* pCore)
         if(gm.g_mode != GAMEMODE_DWARF || gm.g_type != GAMETYPE_DWARF_MAIN)
         {
             // stop running.
-            running = false;
+            setRunning(core, false);
             core.con.printerr("seedwatch deactivated due to game mode switch\n");
             return CR_OK;
         }
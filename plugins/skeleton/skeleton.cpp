@@ -75,6 +75,8 @@ DFhackCExport command_result plugin_onstatechange(Core* c, state_change_event ev
 
 // Whatever you put here will be done in each game step. Don't abuse it.
 // It's optional, so you can just comment it out like this if you don't need it.
+// If you don't need it every frame, tell the plugin manager how often to call it:
+//   c->getPluginManager()->setUpdateSchedule("skeleton", US_TICKS, 100);
 /*
 DFhackCExport command_result plugin_onupdate ( Core * c )
 {
@@ -4,6 +4,7 @@
 #include <map>
 #include <set>
 #include <cstdlib>
+#include <algorithm>
 #include <sstream>
 using std::vector;
 using std::string;
@@ -19,6 +20,7 @@ using std::set;
 #include "modules/Gui.h"
 #include "TileTypes.h"
 #include "modules/MapCache.h"
+#include "modules/Brushes.h"
 #include "df/tile_dig_designation.h"
 using namespace MapExtras;
 using namespace DFHack;
@@ -487,150 +489,6 @@ void help( std::ostream & out, const std::string &option)
     }
 }
 
-typedef std::vector<DFHack::DFCoord> coord_vec;
-
-class Brush
-{
-public:
-    virtual ~Brush() {};
-    virtual coord_vec points(MapExtras::MapCache &mc, DFHack::DFCoord start) = 0;
-};
-/**
- * generic 3D rectangle brush. you can specify the dimensions of
- * the rectangle and optionally which tile is its 'center'
- */
-class RectangleBrush : public Brush
-{
-    int x_, y_, z_;
-    int cx_, cy_, cz_;
-
-public:
-    RectangleBrush(int x, int y, int z = 1, int centerx = -1, int centery = -1, int centerz = -1)
-    {
-        if (centerx == -1)
-        {
-            cx_ = x/2;
-        }
-        else
-        {
-            cx_ = centerx;
-        }
-
-        if (centery == -1)
-        {
-            cy_ = y/2;
-        }
-        else
-        {
-            cy_ = centery;
-        }
-
-        if (centerz == -1)
-        {
-            cz_ = z/2;
-        }
-        else
-        {
-            cz_ = centerz;
-        }
-
-        x_ = x;
-        y_ = y;
-        z_ = z;
-    };
-
-    coord_vec points(MapExtras::MapCache &mc, DFHack::DFCoord start)
-    {
-        coord_vec v;
-        DFHack::DFCoord iterstart(start.x - cx_, start.y - cy_, start.z - cz_);
-        DFHack::DFCoord iter = iterstart;
-        for (int xi = 0; xi < x_; xi++)
-        {
-            for (int yi = 0; yi < y_; yi++)
-            {
-                for (int zi = 0; zi < z_; zi++)
-                {
-                    if(mc.testCoord(iter))
-                        v.push_back(iter);
-
-                    iter.z++;
-                }
-
-                iter.z = iterstart.z;
-                iter.y++;
-            }
-
-            iter.y = iterstart.y;
-            iter.x ++;
-        }
-
-        return v;
-    };
-
-    ~RectangleBrush(){};
-};
-
-/**
- * stupid block brush, legacy. use when you want to apply something to a whole DF map block.
- */
-class BlockBrush : public Brush
-{
-public:
-    BlockBrush() {};
-    ~BlockBrush() {};
-
-    coord_vec points(MapExtras::MapCache &mc, DFHack::DFCoord start)
-    {
-        coord_vec v;
-        DFHack::DFCoord blockc = start % 16;
-        DFHack::DFCoord iterc = blockc * 16;
-        if (!mc.testCoord(start))
-            return v;
-
-        for (int xi = 0; xi < 16; xi++)
-        {
-            for (int yi = 0; yi < 16; yi++)
-            {
-                v.push_back(iterc);
-                iterc.y++;
-            }
-            iterc.x++;
-        }
-
-        return v;
-    };
-};
-
-/**
- * Column from a position through open space tiles
- * example: create a column of magma
- */
-class ColumnBrush : public Brush
-{
-public:
-    ColumnBrush(){};
-
-    ~ColumnBrush(){};
-
-    coord_vec points(MapExtras::MapCache &mc, DFHack::DFCoord start)
-    {
-        coord_vec v;
-        bool juststarted = true;
-        while (mc.testCoord(start))
-        {
-            df::tiletype tt = mc.tiletypeAt(start);
-            if(LowPassable(tt) || juststarted && HighPassable(tt))
-            {
-                v.push_back(start);
-                juststarted = false;
-                start.z++;
-            }
-            else break;
-        }
-        return v;
-    };
-};
-
 CommandHistory tiletypes_hist;
 
 command_result df_tiletypes (Core * c, vector <string> & parameters);
@@ -788,114 +646,130 @@ command_result df_tiletypes (Core * c, vector <string> & parameters)
             c->con.print("Cursor coords: (%d, %d, %d)\n",x,y,z);
 
             DFHack::DFCoord cursor(x,y,z);
-            MapExtras::MapCache map;
-            coord_vec all_tiles = brush->points(map, cursor);
+            MapExtras::MapCache * cache = c->getMapCache();
+            if (!cache)
+            {
+                c->con.printerr("Map is not available!\n");
+                return CR_FAILURE;
+            }
+            MapExtras::MapCache & map = *cache;
+            brush->begin(map, cursor);
             c->con.print("working...\n");
 
-            for (coord_vec::iterator iter = all_tiles.begin(); iter != all_tiles.end(); ++iter)
+            BlockMask mask;
+            while (brush->next(mask))
             {
-                const df::tiletype source = map.tiletypeAt(*iter);
-                df::tile_designation des = map.designationAt(*iter);
-
-                if ((filter.shape > -1 && filter.shape != tileShape(source))
-                 || (filter.material > -1 && filter.material != tileMaterial(source))
-                 || (filter.special > -1 && filter.special != tileSpecial(source))
-                 || (filter.variant > -1 && filter.variant != tileVariant(source))
-		 || (filter.dig > -1 && (filter.dig != 0) != (des.bits.dig != tile_dig_designation::No))
-                )
-                {
-                    continue;
-                }
-
-                df::tiletype_shape shape = paint.shape;
-                if (shape == tiletype_shape::NONE)
-                {
-                    shape = tileShape(source);
-                }
-
-                df::tiletype_material material = paint.material;
-                if (material == tiletype_material::NONE)
-                {
-                    material = tileMaterial(source);
-                }
-
-                df::tiletype_special special = paint.special;
-                if (special == tiletype_special::NONE)
-                {
-                    special = tileSpecial(source);
-                }
-                df::tiletype_variant variant = paint.variant;
-                /*
-                 * FIXME: variant should be:
-                 * 1. If user variant:
-                 * 2.   If user variant \belongs target variants
-                 * 3.     use user variant
-                 * 4.   Else
-                 * 5.     use variant 0
-                 * 6. If the source variant \belongs target variants
-                 * 7    use source variant
-                 * 8  ElseIf num target shape/material variants > 1
-                 * 9.   pick one randomly
-                 * 10.Else
-                 * 11.  use variant 0
-                 *
-                 * The following variant check has been disabled because it's severely limiting
-                 * the usefullness of the tool.
-                 */
-                /*
-                if (variant == tiletype_variant::NONE)
-                {
-                    variant = tileVariant(source);
-                }
-                */
-                // Remove direction from directionless tiles
-                DFHack::TileDirection direction = tileDirection(source);
-                if (!(shape == tiletype_shape::RIVER_BED || shape == tiletype_shape::BROOK_BED || shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))) {
-                    direction.whole = 0;
-                }
-
-                df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
-                // hack for empty space
-                if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0) {
-                    type = tiletype::OpenSpace;
-                }
-                // make sure it's not invalid
-                if(type != tiletype::Void)
-                    map.setTiletypeAt(*iter, type);
-
-                if (paint.hidden > -1)
-                {
-                    des.bits.hidden = paint.hidden;
-                }
-
-                if (paint.light > -1)
-                {
-                    des.bits.light = paint.light;
-                }
-
-                if (paint.subterranean > -1)
-                {
-                    des.bits.subterranean = paint.subterranean;
-                }
-
-                if (paint.skyview > -1)
-                {
-                    des.bits.outside = paint.skyview;
-                }
-
-                // Remove liquid from walls, etc
-                if (type != -1 && !DFHack::FlowPassable(type))
+                Block *b = map.BlockAt(mask.block);
+                for (int x = 0; x < 16; x++) for (int y = 0; y < 16; y++)
                 {
-                    des.bits.flow_size = 0;
-                    //des.bits.liquid_type = DFHack::liquid_water;
-                    //des.bits.water_table = 0;
-                    des.bits.flow_forbid = 0;
-                    //des.bits.liquid_static = 0;
-                    //des.bits.water_stagnant = 0;
-                    //des.bits.water_salt = 0;
+                    if (!mask.has(x, y))
+                    {
+                        continue;
+                    }
+                    df::coord2d p(x, y);
+                    const df::tiletype source = b->TileTypeAt(p);
+                    df::tile_designation des = b->DesignationAt(p);
+
+                    if ((filter.shape > -1 && filter.shape != tileShape(source))
+                     || (filter.material > -1 && filter.material != tileMaterial(source))
+                     || (filter.special > -1 && filter.special != tileSpecial(source))
+                     || (filter.variant > -1 && filter.variant != tileVariant(source))
+		 || (filter.dig > -1 && (filter.dig != 0) != (des.bits.dig != tile_dig_designation::No))
+                    )
+                    {
+                        continue;
+                    }
+
+                    df::tiletype_shape shape = paint.shape;
+                    if (shape == tiletype_shape::NONE)
+                    {
+                        shape = tileShape(source);
+                    }
+
+                    df::tiletype_material material = paint.material;
+                    if (material == tiletype_material::NONE)
+                    {
+                        material = tileMaterial(source);
+                    }
+
+                    df::tiletype_special special = paint.special;
+                    if (special == tiletype_special::NONE)
+                    {
+                        special = tileSpecial(source);
+                    }
+                    df::tiletype_variant variant = paint.variant;
+                    /*
+                     * FIXME: variant should be:
+                     * 1. If user variant:
+                     * 2.   If user variant \belongs target variants
+                     * 3.     use user variant
+                     * 4.   Else
+                     * 5.     use variant 0
+                     * 6. If the source variant \belongs target variants
+                     * 7    use source variant
+                     * 8  ElseIf num target shape/material variants > 1
+                     * 9.   pick one randomly
+                     * 10.Else
+                     * 11.  use variant 0
+                     *
+                     * The following variant check has been disabled because it's severely limiting
+                     * the usefullness of the tool.
+                     */
+                    /*
+                    if (variant == tiletype_variant::NONE)
+                    {
+                        variant = tileVariant(source);
+                    }
+                    */
+                    // Remove direction from directionless tiles
+                    DFHack::TileDirection direction = tileDirection(source);
+                    if (!(shape == tiletype_shape::RIVER_BED || shape == tiletype_shape::BROOK_BED || shape == tiletype_shape::WALL && (material == tiletype_material::CONSTRUCTION || special == tiletype_special::SMOOTH))) {
+                        direction.whole = 0;
+                    }
+
+                    df::tiletype type = DFHack::findTileType(shape, material, variant, special, direction);
+                    // hack for empty space
+                    if (shape == tiletype_shape::EMPTY && material == tiletype_material::AIR && variant == tiletype_variant::VAR_1 && special == tiletype_special::NORMAL && direction.whole == 0) {
+                        type = tiletype::OpenSpace;
+                    }
+                    // make sure it's not invalid
+                    if(type != tiletype::Void)
+                        b->setTiletypeAt(p, type);
+
+                    if (paint.hidden > -1)
+                    {
+                        des.bits.hidden = paint.hidden;
+                    }
+
+                    if (paint.light > -1)
+                    {
+                        des.bits.light = paint.light;
+                    }
+
+                    if (paint.subterranean > -1)
+                    {
+                        des.bits.subterranean = paint.subterranean;
+                    }
+
+                    if (paint.skyview > -1)
+                    {
+                        des.bits.outside = paint.skyview;
+                    }
+
+                    // Remove liquid from walls, etc
+                    if (type != -1 && !DFHack::FlowPassable(type))
+                    {
+                        des.bits.flow_size = 0;
+                        //des.bits.liquid_type = DFHack::liquid_water;
+                        //des.bits.water_table = 0;
+                        des.bits.flow_forbid = 0;
+                        //des.bits.liquid_static = 0;
+                        //des.bits.water_stagnant = 0;
+                        //des.bits.water_salt = 0;
+                    }
+
+                    b->setDesignationAt(p, des);
                 }
-
-                map.setDesignationAt(*iter, des);
             }
 
             if (map.WriteAll())
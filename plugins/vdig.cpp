@@ -7,12 +7,12 @@
 #include "modules/MapCache.h"
 #include <vector>
 #include <cstdio>
-#include <stack>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <map>
 using std::vector;
 using std::string;
-using std::stack;
 using namespace DFHack;
 using namespace df::enums;
 
@@ -69,116 +69,169 @@ enum circle_what
     circle_invert,
 };
 
-bool dig (MapExtras::MapCache & MCache,
-    circle_what what,
-    df::tile_dig_designation type,
-    int32_t x, int32_t y, int32_t z,
-    int x_max, int y_max
-    )
+// bit x of row y is tile x,y of a block
+typedef uint16_t digbits[16];
+
+struct digrows
 {
-    DFCoord at (x,y,z);
-    auto b = MCache.BlockAt(at/16);
-    if(!b || !b->valid)
-        return false;
-    if(x == 0 || x == x_max * 16 - 1)
+    digbits rows;
+};
+
+// the tiles of a shape, by block
+typedef std::map<DFCoord, digrows> digstamp;
+
+// the tiles of a block that aren't on the map border
+void border_mask(uint32_t bx, uint32_t by, int x_max, int y_max, digbits & bits)
+{
+    uint16_t cols = 0xFFFF;
+    if(bx == 0)
+        cols &= ~1;
+    if(bx == x_max - 1)
+        cols &= ~0x8000;
+    for(int y = 0; y < 16; y++)
+        bits[y] = cols;
+    if(by == 0)
+        bits[0] = 0;
+    if(by == y_max - 1)
+        bits[15] = 0;
+}
+
+// the rows of a block in the stamp, empty ones for a block it doesn't have yet
+digrows & stamp_rows (digstamp & stamp, int32_t bx, int32_t by, int32_t z)
+{
+    DFCoord block(bx, by, z);
+    digstamp::iterator it = stamp.find(block);
+    if(it == stamp.end())
     {
-        //c->con.print("not digging map border\n");
+        digrows empty;
+        memset(empty.rows, 0, sizeof(empty.rows));
+        it = stamp.insert(std::make_pair(block, empty)).first;
+    }
+    return it->second;
+}
+
+// the span from x1 to x2 goes into each block it crosses as one row mask
+bool lineY (digstamp & stamp, int32_t x1, int32_t x2, int32_t y, int32_t z)
+{
+    if(y < 0 || z < 0 || x2 < 0)
         return false;
+    if(x1 < 0)
+        x1 = 0;
+    for(int32_t bx = x1 / 16; bx <= x2 / 16; bx++)
+    {
+        int lo = std::max(x1, bx * 16) - bx * 16;
+        int hi = std::min(x2, bx * 16 + 15) - bx * 16;
+        uint16_t bits = (0xFFFF << lo) & (0xFFFF >> (15 - hi));
+        stamp_rows(stamp, bx, y / 16, z).rows[y % 16] |= bits;
     }
-    if(y == 0 || y == y_max * 16 - 1)
+    return true;
+};
+
+bool dig (digstamp & stamp, int32_t x, int32_t y, int32_t z)
+{
+    return lineY(stamp, x, x, y, z);
+};
+
+bool lineX (digstamp & stamp, int32_t y1, int32_t y2, int32_t x, int32_t z)
+{
+    for(int32_t y = y1; y <= y2; y++)
     {
-        //c->con.print("not digging map border\n");
-        return false;
+        dig(stamp, x, y, z);
     }
-    df::tiletype tt = MCache.tiletypeAt(at);
-    df::tile_designation des = MCache.designationAt(at);
+    return true;
+};
+
+// can a tile be designated for this kind of digging
+bool can_dig (df::tiletype tt, df::tile_designation des, df::tile_dig_designation type)
+{
     // could be potentially used to locate hidden constructions?
     if(tileMaterial(tt) == df::tiletype_material::CONSTRUCTION && !des.bits.hidden)
         return false;
     df::tiletype_shape ts = tileShape(tt);
     if (ts == tiletype_shape::EMPTY)
         return false;
-    if(!des.bits.hidden)
+    if(des.bits.hidden)
+        return true;
+    df::tiletype_shape_basic tsb = ENUM_ATTR(tiletype_shape, basic_shape, ts);
+    if(tsb == tiletype_shape_basic::Wall)
+        return true;
+    if (tsb == tiletype_shape_basic::Floor
+        && (type == tile_dig_designation::DownStair || type == tile_dig_designation::Channel)
+        && ts != tiletype_shape::TREE
+        )
+        return true;
+    if (tsb == tiletype_shape_basic::Stair && type == tile_dig_designation::Channel )
+        return true;
+    return false;
+}
+
+// designates the tiles of the stamp, a block at a time
+size_t apply_stamp (digstamp & stamp, circle_what what, df::tile_dig_designation type,
+    int x_max, int y_max
+    )
+{
+    size_t count = 0;
+    for(digstamp::iterator it = stamp.begin(); it != stamp.end(); it++)
     {
-        do
+        DFCoord bc = it->first;
+        df::map_block * bl = Maps::getBlock(bc.x, bc.y, bc.z);
+        if(!bl)
+            continue;
+        digbits inside;
+        border_mask(bc.x, bc.y, x_max, y_max, inside);
+        bool changed = false;
+        for(int y = 0; y < 16; y++)
         {
-            df::tiletype_shape_basic tsb = ENUM_ATTR(tiletype_shape, basic_shape, ts);
-            if(tsb == tiletype_shape_basic::Wall)
+            uint16_t row = it->second.rows[y] & inside[y];
+            if(!row)
+                continue;
+            // which tiles of the row can be dug this way, and which already are designated
+            uint16_t diggable = 0, designated = 0;
+            for(int x = 0; x < 16; x++)
             {
-                std::cerr << "allowing tt" << (int)tt << ", is wall\n";
-                break;
+                df::tile_designation des = bl->designation[x][y];
+                if(!can_dig(bl->tiletype[x][y], des, type))
+                    continue;
+                diggable |= 1 << x;
+                if(des.bits.dig != tile_dig_designation::No)
+                    designated |= 1 << x;
             }
-            if (tsb == tiletype_shape_basic::Floor
-                && (type == tile_dig_designation::DownStair || type == tile_dig_designation::Channel)
-                && ts != tiletype_shape::TREE
-                )
+            row &= diggable;
+            if(!row)
+                continue;
+            uint16_t set = 0, clear = 0;
+            switch(what)
             {
-                std::cerr << "allowing tt" << (int)tt << ", is floor\n";
+            case circle_set:
+                set = row & ~designated;
                 break;
-            }
-            if (tsb == tiletype_shape_basic::Stair && type == tile_dig_designation::Channel )
+            case circle_unset:
+                clear = row;
                 break;
-            return false;
-        }
-        while(0);
-    }
-    switch(what)
-    {
-    case circle_set:
-        if(des.bits.dig == tile_dig_designation::No)
-        {
-            des.bits.dig = type;
-        }
-        break;
-    case circle_unset:
-        if (des.bits.dig != tile_dig_designation::No)
-        {
-            des.bits.dig = tile_dig_designation::No;
-        }
-        break;
-    case circle_invert:
-        if(des.bits.dig == tile_dig_designation::No)
-        {
-            des.bits.dig = type;
+            case circle_invert:
+                set = row & ~designated;
+                clear = row & designated;
+                break;
+            }
+            for(int x = 0; set | clear; x++, set >>= 1, clear >>= 1)
+            {
+                if(set & 1)
+                    bl->designation[x][y].bits.dig = type;
+                else if(clear & 1)
+                    bl->designation[x][y].bits.dig = tile_dig_designation::No;
+            }
+            changed = true;
+            for(; row; row &= row - 1)
+                count++;
         }
-        else
+        if(changed)
         {
-            des.bits.dig = tile_dig_designation::No;
+            bl->flags.bits.designated = true;
+            Maps::markBlockWritten(bl);
         }
-        break;
-    }
-    std::cerr << "allowing tt" << (int)tt << "\n";
-    MCache.setDesignationAt(at,des);
-    return true;
-};
-
-bool lineX (MapExtras::MapCache & MCache,
-    circle_what what,
-    df::tile_dig_designation type,
-    int32_t y1, int32_t y2, int32_t x, int32_t z,
-    int x_max, int y_max
-    )
-{
-    for(int32_t y = y1; y <= y2; y++)
-    {
-        dig(MCache, what, type,x,y,z, x_max, y_max);
     }
-    return true;
-};
-
-bool lineY (MapExtras::MapCache & MCache,
-    circle_what what,
-    df::tile_dig_designation type,
-    int32_t x1, int32_t x2, int32_t y, int32_t z,
-    int x_max, int y_max
-    )
-{
-    for(int32_t x = x1; x <= x2; x++)
-    {
-        dig(MCache, what, type,x,y,z, x_max, y_max);
-    }
-    return true;
-};
+    return count;
+}
 
 command_result digcircle (Core * c, vector <string> & parameters)
 {
@@ -286,12 +339,13 @@ command_result digcircle (Core * c, vector <string> & parameters)
     uint32_t x_max, y_max, z_max;
     Maps::getSize(x_max,y_max,z_max);
 
-    MapExtras::MapCache MCache;
     if(!gui->getCursorCoords(cx,cy,cz) || cx == -30000)
     {
         c->con.printerr("Can't get the cursor coords...\n");
         return CR_FAILURE;
     }
+    // every tile only once, even where the outline touches itself
+    digstamp stamp;
     int r = diameter / 2;
     int iter;
     bool adjust;
@@ -300,12 +354,12 @@ command_result digcircle (Core * c, vector <string> & parameters)
         // paint center
         if(filled)
         {
-            lineY(MCache,what,type, cx - r, cx + r, cy, cz,x_max,y_max);
+            lineY(stamp, cx - r, cx + r, cy, cz);
         }
         else
         {
-            dig(MCache, what, type,cx - r, cy, cz,x_max,y_max);
-            dig(MCache, what, type,cx + r, cy, cz,x_max,y_max);
+            dig(stamp, cx - r, cy, cz);
+            dig(stamp, cx + r, cy, cz);
         }
         adjust = false;
         iter = 2;
@@ -337,28 +391,28 @@ command_result digcircle (Core * c, vector <string> & parameters)
         // paint
         if(filled || iter == diameter - 1)
         {
-            lineY(MCache,what,type, left, right, top , cz,x_max,y_max);
-            lineY(MCache,what,type, left, right, bottom , cz,x_max,y_max);
+            lineY(stamp, left, right, top , cz);
+            lineY(stamp, left, right, bottom , cz);
         }
         else
         {
-            dig(MCache, what, type,left, top, cz,x_max,y_max);
-            dig(MCache, what, type,left, bottom, cz,x_max,y_max);
-            dig(MCache, what, type,right, top, cz,x_max,y_max);
-            dig(MCache, what, type,right, bottom, cz,x_max,y_max);
+            dig(stamp, left, top, cz);
+            dig(stamp, left, bottom, cz);
+            dig(stamp, right, top, cz);
+            dig(stamp, right, bottom, cz);
         }
         if(!filled && diff > 1)
         {
             int lright = cx + lastwhole;
             int lleft = cx - lastwhole + adjust;
-            lineY(MCache,what,type, lleft + 1, left - 1, top + 1 , cz,x_max,y_max);
-            lineY(MCache,what,type, right + 1, lright - 1, top + 1 , cz,x_max,y_max);
-            lineY(MCache,what,type, lleft + 1, left - 1, bottom - 1 , cz,x_max,y_max);
-            lineY(MCache,what,type, right + 1, lright - 1, bottom - 1 , cz,x_max,y_max);
+            lineY(stamp, lleft + 1, left - 1, top + 1 , cz);
+            lineY(stamp, right + 1, lright - 1, top + 1 , cz);
+            lineY(stamp, lleft + 1, left - 1, bottom - 1 , cz);
+            lineY(stamp, right + 1, lright - 1, bottom - 1 , cz);
         }
         lastwhole = whole;
     }
-    MCache.WriteAll();
+    apply_stamp(stamp, what, type, x_max, y_max);
     return CR_OK;
 }
 typedef char digmask[16][16];
@@ -724,56 +778,72 @@ enum explo_what
     EXPLO_DESIGNATED,
 };
 
+// bit x of row y is set where the pattern has dm[y][x]
+void pack_mask (const digmask & dm, digbits & bits)
+{
+    for(int y = 0; y < 16; y++)
+    {
+        bits[y] = 0;
+        for(int x = 0; x < 16; x++)
+            if(dm[y][x])
+                bits[y] |= 1 << x;
+    }
+}
+
 bool stamp_pattern (uint32_t bx, uint32_t by, int z_level,
-    digmask & dm, explo_how how, explo_what what,
+    const digbits & dm, explo_how how, explo_what what,
     int x_max, int y_max
     )
 {
     df::map_block * bl = Maps::getBlock(bx,by,z_level);
     if(!bl)
         return false;
-    int x = 0,mx = 16;
-    if(bx == 0)
-        x = 1;
-    if(bx == x_max - 1)
-        mx = 15;
-    for(; x < mx; x++)
+    digbits inside;
+    border_mask(bx, by, x_max, y_max, inside);
+    for(int y = 0; y < 16; y++)
     {
-        int y = 0,my = 16;
-        if(by == 0)
-            y = 1;
-        if(by == y_max - 1)
-            my = 15;
-        for(; y < my; y++)
+        if(!inside[y])
+            continue;
+        // which tiles of the row can be dug at all, and which are hidden or designated
+        uint16_t diggable = 0, hidden = 0, designated = 0;
+        for(int x = 0; x < 16; x++)
         {
-            df::tile_designation & des = bl->designation[x][y];
+            df::tile_designation des = bl->designation[x][y];
             df::tiletype tt = bl->tiletype[x][y];
-            // could be potentially used to locate hidden constructions?
-            if(tileMaterial(tt) == tiletype_material::CONSTRUCTION && !des.bits.hidden)
+            if(des.bits.hidden)
+                hidden |= 1 << x;
+            else if(tileMaterial(tt) == tiletype_material::CONSTRUCTION || !isWallTerrain(tt))
+                // could be potentially used to locate hidden constructions?
                 continue;
-            if(!isWallTerrain(tt) && !des.bits.hidden)
-                continue;
-            if(how == EXPLO_CLEAR)
-            {
-                des.bits.dig = tile_dig_designation::No;
-                continue;
-            }
-            if(dm[y][x])
-            {
-                if(what == EXPLO_ALL
-                    || des.bits.dig == tile_dig_designation::Default && what == EXPLO_DESIGNATED
-                    || des.bits.hidden && what == EXPLO_HIDDEN)
-                {
-                    des.bits.dig = tile_dig_designation::Default;
-                }
-            }
-            else if(what == EXPLO_DESIGNATED)
+            diggable |= 1 << x;
+            if(des.bits.dig == tile_dig_designation::Default)
+                designated |= 1 << x;
+        }
+        diggable &= inside[y];
+        uint16_t set = 0, clear = 0;
+        if(how == EXPLO_CLEAR)
+            clear = diggable;
+        else
+        {
+            set = dm[y] & diggable;
+            if(what == EXPLO_DESIGNATED)
             {
-                des.bits.dig = tile_dig_designation::No;
+                set &= designated;
+                clear = diggable & ~dm[y];
             }
+            else if(what == EXPLO_HIDDEN)
+                set &= hidden;
+        }
+        for(int x = 0; set | clear; x++, set >>= 1, clear >>= 1)
+        {
+            if(set & 1)
+                bl->designation[x][y].bits.dig = tile_dig_designation::Default;
+            else if(clear & 1)
+                bl->designation[x][y].bits.dig = tile_dig_designation::No;
         }
     }
     bl->flags.bits.designated = true;
+    Maps::markBlockWritten(bl);
     return true;
 };
 
@@ -867,52 +937,64 @@ command_result expdig (Core * c, vector <string> & parameters)
     }
     if(how == EXPLO_DIAG5)
     {
+        digbits bits[5];
+        for(int i = 0; i < 5; i++)
+            pack_mask(diag5[i], bits[i]);
         int which;
         for(uint32_t x = 0; x < x_max; x++)
         {
             for(int32_t y = 0 ; y < y_max; y++)
             {
                 which = (4*x + y) % 5;
-                stamp_pattern(x,y_max - 1 - y, z_level, diag5[which],
+                stamp_pattern(x,y_max - 1 - y, z_level, bits[which],
                     how, what, x_max, y_max);
             }
         }
     }
     else if(how == EXPLO_DIAG5R)
     {
+        digbits bits[5];
+        for(int i = 0; i < 5; i++)
+            pack_mask(diag5r[i], bits[i]);
         int which;
         for(uint32_t x = 0; x < x_max; x++)
         {
             for(int32_t y = 0 ; y < y_max; y++)
             {
                 which = (4*x + 1000-y) % 5;
-                stamp_pattern(x,y_max - 1 - y, z_level, diag5r[which],
+                stamp_pattern(x,y_max - 1 - y, z_level, bits[which],
                     how, what, x_max, y_max);
             }
         }
     }
     else if(how == EXPLO_LADDER)
     {
+        digbits bits[3];
+        for(int i = 0; i < 3; i++)
+            pack_mask(ladder[i], bits[i]);
         int which;
         for(uint32_t x = 0; x < x_max; x++)
         {
             which = x % 3;
             for(int32_t y = 0 ; y < y_max; y++)
             {
-                stamp_pattern(x, y, z_level, ladder[which],
+                stamp_pattern(x, y, z_level, bits[which],
                     how, what, x_max, y_max);
             }
         }
     }
     else if(how == EXPLO_LADDERR)
     {
+        digbits bits[3];
+        for(int i = 0; i < 3; i++)
+            pack_mask(ladderr[i], bits[i]);
         int which;
         for(int32_t y = 0 ; y < y_max; y++)
         {
             which = y % 3;
             for(uint32_t x = 0; x < x_max; x++)
             {
-                stamp_pattern(x, y, z_level, ladderr[which],
+                stamp_pattern(x, y, z_level, bits[which],
                     how, what, x_max, y_max);
             }
         }
@@ -922,33 +1004,38 @@ command_result expdig (Core * c, vector <string> & parameters)
         // middle + recentering for the image
         int xmid = x_max * 8 - 8;
         int ymid = y_max * 8 - 8;
-        MapExtras::MapCache mx;
-        for(int x = 0; x < 16; x++)
-            for(int y = 0; y < 16; y++)
+        digbits bits;
+        pack_mask(cross, bits);
+        // the cross straddles up to four blocks, shift it into each of them
+        int sx = xmid % 16, sy = ymid % 16;
+        for(int dx = 0; dx < 2; dx++)
+            for(int dy = 0; dy < 2; dy++)
             {
-                DFCoord pos(xmid+x,ymid+y,z_level);
-                df::tiletype tt = mx.tiletypeAt(pos);
-                if(tt == tiletype::Void)
-                    continue;
-                df::tile_designation des = mx.designationAt(pos);
-                if(tileMaterial(tt) == tiletype_material::CONSTRUCTION && !des.bits.hidden)
-                    continue;
-                if(!isWallTerrain(tt) && !des.bits.hidden)
-                    continue;
-                if(cross[y][x])
+                digbits part;
+                bool any = false;
+                for(int y = 0; y < 16; y++)
                 {
-                    des.bits.dig = tile_dig_designation::Default;
-                    mx.setDesignationAt(pos,des);
+                    int py = y + dy * 16 - sy;
+                    uint32_t row = (py >= 0 && py < 16) ? bits[py] : 0;
+                    part[y] = dx ? row >> (16 - sx) : uint16_t(row << sx);
+                    any |= part[y] != 0;
                 }
+                if(any)
+                    stamp_pattern(xmid / 16 + dx, ymid / 16 + dy, z_level, part,
+                        how, EXPLO_ALL, x_max, y_max);
             }
-            mx.WriteAll();
     }
-    else for(uint32_t x = 0; x < x_max; x++)
+    else
     {
-        for(int32_t y = 0 ; y < y_max; y++)
+        digbits bits;
+        pack_mask(all_tiles, bits);
+        for(uint32_t x = 0; x < x_max; x++)
         {
-            stamp_pattern(x, y, z_level, all_tiles,
-                how, what, x_max, y_max);
+            for(int32_t y = 0 ; y < y_max; y++)
+            {
+                stamp_pattern(x, y, z_level, bits,
+                    how, what, x_max, y_max);
+            }
         }
     }
     return CR_OK;
@@ -1000,123 +1087,45 @@ command_result vdig (Core * c, vector <string> & parameters)
         con.printerr("I won't dig the borders. That would be cheating!\n");
         return CR_FAILURE;
     }
-    MapExtras::MapCache * MCache = new MapExtras::MapCache;
-    df::tile_designation des = MCache->designationAt(xy);
-    df::tiletype tt = MCache->tiletypeAt(xy);
-    int16_t veinmat = MCache->veinMaterialAt(xy);
-    if( veinmat == -1 )
+    // only the blocks around this vein get looked at again
+    uint32_t vein = Maps::updateVeinAt(cx, cy, cz, updown);
+    if(!vein)
     {
         con.printerr("This tile is not a vein.\n");
-        delete MCache;
         return CR_FAILURE;
     }
-    con.print("%d/%d/%d tiletype: %d, veinmat: %d, designation: 0x%x ... DIGGING!\n", cx,cy,cz, tt, veinmat, des.whole);
-    stack <DFHack::DFCoord> flood;
-    flood.push(xy);
-
-    while( !flood.empty() )
+    MapExtras::MapCache * MCache = c->getMapCache();
+    if(!MCache)
     {
-        DFHack::DFCoord current = flood.top();
-        flood.pop();
-        int16_t vmat2 = MCache->veinMaterialAt(current);
-        tt = MCache->tiletypeAt(current);
-        if(!DFHack::isWallTerrain(tt))
-            continue;
-        if(vmat2!=veinmat)
+        con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+    df::tile_designation des = MCache->designationAt(xy);
+    df::tiletype tt = MCache->tiletypeAt(xy);
+    vector<DFCoord> tiles;
+    Maps::getVeinTiles(vein, tiles, updown);
+    con.print("%d/%d/%d tiletype: %d, veinmat: %d, designation: 0x%x, %d tiles ... DIGGING!\n",
+        cx,cy,cz, tt, Maps::getVeinMaterial(vein), des.whole, int(tiles.size()));
+    for(size_t i = 0; i < tiles.size(); i++)
+    {
+        DFCoord current = tiles[i];
+        // don't dig the borders
+        if(current.x == 0 || current.x >= tx_max - 1 || current.y == 0 || current.y >= ty_max - 1)
             continue;
-
-        // found a good tile, dig+unset material
-        df::tile_designation des = MCache->designationAt(current);
-        df::tile_designation des_minus;
-        df::tile_designation des_plus;
-        des_plus.whole = des_minus.whole = 0;
-        int16_t vmat_minus = -1;
-        int16_t vmat_plus = -1;
-        bool below = 0;
-        bool above = 0;
-        if(updown)
-        {
-            if(MCache->testCoord(current-1))
-            {
-                below = 1;
-                des_minus = MCache->designationAt(current-1);
-                vmat_minus = MCache->veinMaterialAt(current-1);
-            }
-
-            if(MCache->testCoord(current+1))
-            {
-                above = 1;
-                des_plus = MCache->designationAt(current+1);
-                vmat_plus = MCache->veinMaterialAt(current+1);
-            }
-        }
-        if(MCache->testCoord(current))
-        {
-            MCache->clearMaterialAt(current);
-            if(current.x < tx_max - 2)
-            {
-                flood.push(DFHack::DFCoord(current.x + 1, current.y, current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y + 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1,current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x + 1, current.y - 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1,current.z));
-                }
-            }
-            if(current.x > 1)
-            {
-                flood.push(DFHack::DFCoord(current.x - 1, current.y,current.z));
-                if(current.y < ty_max - 2)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y + 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y + 1,current.z));
-                }
-                if(current.y > 1)
-                {
-                    flood.push(DFHack::DFCoord(current.x - 1, current.y - 1,current.z));
-                    flood.push(DFHack::DFCoord(current.x, current.y - 1,current.z));
-                }
-            }
-            if(updown)
-            {
-                if(current.z > 0 && below && vmat_minus == vmat2)
-                {
-                    flood.push(current-1);
-
-                    if(des_minus.bits.dig == tile_dig_designation::DownStair)
-                        des_minus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_minus.bits.dig = tile_dig_designation::UpStair;
-                    MCache->setDesignationAt(current-1,des_minus);
-
-                    des.bits.dig = tile_dig_designation::DownStair;
-                }
-                if(current.z < z_max - 1 && above && vmat_plus == vmat2)
-                {
-                    flood.push(current+ 1);
-
-                    if(des_plus.bits.dig == tile_dig_designation::UpStair)
-                        des_plus.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des_plus.bits.dig = tile_dig_designation::DownStair;
-                    MCache->setDesignationAt(current+1,des_plus);
-
-                    if(des.bits.dig == tile_dig_designation::DownStair)
-                        des.bits.dig = tile_dig_designation::UpDownStair;
-                    else
-                        des.bits.dig = tile_dig_designation::UpStair;
-                }
-            }
-            if(des.bits.dig == tile_dig_designation::No)
-                des.bits.dig = tile_dig_designation::Default;
-            MCache->setDesignationAt(current,des);
-        }
+        // stairs wherever the vein goes on straight up or down
+        bool go_down = updown && Maps::getVein(current.x, current.y, current.z - 1) == vein;
+        bool go_up = updown && Maps::getVein(current.x, current.y, current.z + 1) == vein;
+        df::tile_designation here = MCache->designationAt(current);
+        if(go_down && go_up)
+            here.bits.dig = tile_dig_designation::UpDownStair;
+        else if(go_down)
+            here.bits.dig = tile_dig_designation::DownStair;
+        else if(go_up)
+            here.bits.dig = tile_dig_designation::UpStair;
+        else if(here.bits.dig == tile_dig_designation::No)
+            here.bits.dig = tile_dig_designation::Default;
+        MCache->setDesignationAt(current,here);
     }
-    MCache->WriteAll();
     return CR_OK;
 }
 
@@ -422,6 +422,12 @@ static void cleanup_state(Core *c)
 static void check_lost_jobs(Core *c, int ticks);
 static ItemConstraint *get_constraint(Core *c, const std::string &str, PersistentDataItem *cfg = NULL);
 
+static void update_plugin_schedule(Core *c)
+{
+    // Every 5 frames check the jobs for disappearance
+    c->getPluginManager()->setUpdateSchedule("workflow", enabled ? US_FRAMES : US_NEVER, 5);
+}
+
 static void start_protect(Core *c)
 {
     check_lost_jobs(c, 0);
@@ -453,6 +459,8 @@ static void init_state(Core *c)
     last_tick_frame_count = world->frame_counter;
     last_frame_count = world->frame_counter;
 
+    update_plugin_schedule(c);
+
     if (!enabled)
         return;
 
@@ -469,6 +477,7 @@ static void enable_plugin(Core *c)
 
     setOptionEnabled(CF_ENABLED, true);
     enabled = true;
+    update_plugin_schedule(c);
     c->con << "Enabling the plugin." << endl;
 
     start_protect(c);
@@ -600,11 +609,6 @@ DFhackCExport command_result plugin_onupdate(Core* c)
     if (!enabled)
         return CR_OK;
 
-    // Every 5 frames check the jobs for disappearance
-    static unsigned cnt = 0;
-    if ((++cnt % 5) != 0)
-        return CR_OK;
-
     check_lost_jobs(c, world->frame_counter - last_tick_frame_count);
     last_tick_frame_count = world->frame_counter;
 
@@ -1440,6 +1444,7 @@ static command_result workflow_cmd(Core *c, vector <string> & parameters)
             {
                 enabled = false;
                 setOptionEnabled(CF_ENABLED, false);
+                update_plugin_schedule(c);
                 stop_protect(c);
             }
 